@@ -0,0 +1,164 @@
+#pragma once
+
+//
+#include "./core.hpp"
+#include "./geometryLevel.hpp"
+#include <fstream>
+#include <filesystem>
+#include <sstream>
+#include <iomanip>
+
+//
+namespace icv {
+
+    //
+    struct AccelerationCacheInfo
+    {
+        std::string directory = "./cache/"; // created on store, with trailing separator
+        std::string extension = ".bvh";
+    };
+
+    // serialized (usually compacted) BLASes on disk, for fast startup (blob header carries driver and compatibility UUID)
+    class AccelerationCache: public DeviceBased {
+        protected:
+        AccelerationCacheInfo info = {};
+        VkQueryPool serializationQuery = VK_NULL_HANDLE;
+
+        // driver UUID, compatibility UUID, serialized size, deserialized size, handle count
+        static constexpr size_t headerSize = VK_UUID_SIZE * 2u + sizeof(uint64_t) * 3u;
+
+        //
+        virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<AccelerationCacheInfo> info = AccelerationCacheInfo{})
+        {
+            this->info = info;
+            this->device = device;
+
+            //
+            VkQueryPoolCreateInfo queryPoolInfo = {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0u,
+                .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+                .queryCount = 1u,
+                .pipelineStatistics = 0u
+            };
+            vkt::handleVk(device->dispatch->CreateQueryPool(&queryPoolInfo, nullptr, &serializationQuery));
+        };
+
+        //
+        virtual std::string getPath(vkh::uni_ptr<GeometryLevel> level)
+        {
+            std::stringstream path;
+            path << info.directory << std::hex << std::setw(16) << std::setfill('0') << this->getKey(level) << info.extension;
+            return path.str();
+        };
+
+        // by same driver and device, otherwise rebuild
+        virtual bool isCompatible(const std::vector<uint8_t>& data)
+        {
+            if (data.size() < headerSize) { return false; };
+            VkAccelerationStructureVersionInfoKHR versionInfo = {
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR,
+                .pNext = nullptr,
+                .pVersionData = data.data()
+            };
+            VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+            device->dispatch->GetDeviceAccelerationStructureCompatibilityKHR(&versionInfo, &compatibility);
+            if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) { return false; };
+
+            // truncated file
+            uint64_t serializedSize = 0ull;
+            memcpy(&serializedSize, data.data() + VK_UUID_SIZE * 2u, sizeof(uint64_t));
+            return serializedSize <= data.size();
+        };
+
+        public:
+        AccelerationCache() {};
+        AccelerationCache(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<AccelerationCacheInfo> info = AccelerationCacheInfo{}) { this->constructor(device, info); };
+
+        // content by application, description and flags by level
+        virtual uint64_t getKey(vkh::uni_ptr<GeometryLevel> level) {
+            return hashCombine(level->getDescriptorHash(), level->getContentHash());
+        };
+
+        // instead of build, false when missing or incompatible (then level should be built as usual)
+        virtual bool load(vkh::uni_ptr<GeometryLevel> level, vkh::uni_ptr<vkf::Queue> queue = {})
+        {
+            if (level->getContentHash() == 0ull) { return false; };
+
+            //
+            std::ifstream file(this->getPath(level), std::ios::binary);
+            if (!file.is_open()) { return false; };
+            std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (!this->isCompatible(data)) { std::cerr << "Acceleration cache is incompatible, rebuilding" << std::endl; return false; };
+
+            //
+            uint64_t deserializedSize = 0ull;
+            memcpy(&deserializedSize, data.data() + VK_UUID_SIZE * 2u + sizeof(uint64_t), sizeof(uint64_t));
+
+            //
+            auto blob = vkf::Vector<uint8_t>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = data.size(), .stride = sizeof(uint8_t), .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU }));
+            memcpy(&blob[0u], data.data(), data.size());
+
+            // only replaced structure is released, others are kept for their frames
+            const VkAccelerationStructureKHR original = level->getAccelerationStructure();
+            queue->submitOnce([&,this](VkCommandBuffer commandBuffer)
+            {   //
+                level->deserializeCommand(commandBuffer, blob.deviceAddress(), deserializedSize);
+            });
+            level->releaseRetiredAcceleration(original);
+            return true;
+        };
+
+        // after build (and compaction), blocking
+        virtual bool store(vkh::uni_ptr<GeometryLevel> level, vkh::uni_ptr<vkf::Queue> queue = {})
+        {
+            if (level->getContentHash() == 0ull || level->isDirty() || !level->getAccelerationStructure()) { return false; };
+
+            //
+            VkAccelerationStructureKHR acceleration = level->getAccelerationStructure();
+            queue->submitOnce([&,this](VkCommandBuffer commandBuffer)
+            {   // build or compaction copy of previous submit
+                VkMemoryBarrier memoryBarrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .pNext = nullptr,
+                    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+                };
+                device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+                device->dispatch->CmdResetQueryPool(commandBuffer, serializationQuery, 0u, 1u);
+                device->dispatch->CmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, 1u, &acceleration, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, serializationQuery, 0u);
+            });
+
+            //
+            VkDeviceSize serializedSize = 0ull;
+            vkt::handleVk(device->dispatch->GetQueryPoolResults(serializationQuery, 0u, 1u, sizeof(VkDeviceSize), &serializedSize, sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+            if (serializedSize <= 0ull) { return false; };
+
+            //
+            auto blob = vkf::Vector<uint8_t>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = serializedSize, .stride = sizeof(uint8_t), .memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU }));
+            queue->submitOnce([&,this](VkCommandBuffer commandBuffer)
+            {   //
+                level->serializeCommand(commandBuffer, blob.deviceAddress());
+            });
+
+            //
+            std::error_code error = {};
+            std::filesystem::create_directories(info.directory, error);
+            std::ofstream file(this->getPath(level), std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) { std::cerr << "Unable to write acceleration cache" << std::endl; return false; };
+            file.write(reinterpret_cast<const char*>(&blob[0u]), serializedSize);
+            return file.good();
+        };
+
+        // from cache, otherwise built and stored
+        virtual void loadOrBuild(vkh::uni_ptr<GeometryLevel> level, vkh::uni_ptr<vkf::Queue> queue = {})
+        {
+            if (this->load(level, queue)) { return; };
+            level->flush(queue);
+            if (level->allowsCompaction()) { level->compact(queue); };
+            this->store(level, queue);
+        };
+    };
+
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+//
+#include "./core.hpp"
+#include "./dataSet.hpp"
+#include "./transferBatch.hpp"
+
+//
+namespace icv {
+
+    //
+    struct AsyncTransferInfo
+    {
+        uint32_t queueFamilyIndex = 0u; // dedicated transfer family, when present (queue should be created with device)
+        uint32_t queueIndex = 0u;
+        uint32_t graphicsFamilyIndex = 0u; // consumer, for ownership transfer
+        VkDeviceSize arenaSize = 16ull * 1024ull * 1024ull;
+    };
+
+    // for submission of pass, which consumes uploaded data
+    struct AsyncTransferWait
+    {
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        uint64_t value = 0ull;
+        VkPipelineStageFlags stages = 0u;
+    };
+
+    // uploads on own queue, signaled by timeline semaphore instead of blocking submit
+    class AsyncTransfer: public DeviceBased {
+        protected:
+        struct Submission {
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            uint64_t value = 0ull;
+            vkh::uni_ptr<TransferBatch> batch = {};
+        };
+
+        //
+        AsyncTransferInfo info = {};
+        VkQueue queue = VK_NULL_HANDLE;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        uint64_t value = 0ull;
+
+        // recording, and in flight
+        vkh::uni_ptr<TransferBatch> batch = {};
+        VkPipelineStageFlags batchStages = 0u;
+        std::vector<Submission> submissions = {};
+        std::vector<vkh::uni_ptr<TransferBatch>> freeBatches = {};
+
+        // submitted, but not acquired by consumer
+        std::vector<VkBufferMemoryBarrier> acquires = {};
+        AsyncTransferWait pending = {};
+
+        //
+        virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<AsyncTransferInfo> info = AsyncTransferInfo{})
+        {
+            this->info = info;
+            this->device = device;
+            device->dispatch->GetDeviceQueue(info->queueFamilyIndex, info->queueIndex, &this->queue);
+
+            //
+            VkCommandPoolCreateInfo commandPoolInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                .queueFamilyIndex = info->queueFamilyIndex
+            };
+            vkt::handleVk(device->dispatch->CreateCommandPool(&commandPoolInfo, nullptr, &this->commandPool));
+
+            //
+            VkSemaphoreTypeCreateInfo semaphoreTypeInfo = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                .pNext = nullptr,
+                .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                .initialValue = 0ull
+            };
+            VkSemaphoreCreateInfo semaphoreInfo = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                .pNext = &semaphoreTypeInfo,
+                .flags = 0u
+            };
+            vkt::handleVk(device->dispatch->CreateSemaphore(&semaphoreInfo, nullptr, &this->semaphore));
+        };
+
+        //
+        virtual vkh::uni_ptr<TransferBatch>& currentBatch()
+        {
+            if (!batch.has()) {
+                if (freeBatches.size() > 0ull) {
+                    this->batch = freeBatches.back();
+                    this->freeBatches.pop_back();
+                } else {
+                    this->batch = std::make_shared<TransferBatch>(device, TransferBatchInfo{ .arenaSize = info.arenaSize });
+                };
+            };
+            return batch;
+        };
+
+        //
+        virtual bool isSameFamily() const {
+            return info.queueFamilyIndex == info.graphicsFamilyIndex;
+        };
+
+        public:
+        AsyncTransfer() {};
+        AsyncTransfer(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<AsyncTransferInfo> info = AsyncTransferInfo{}) { this->constructor(device, info); };
+
+        // after every submitted upload
+        ~AsyncTransfer() {
+            if (!device.has() || !commandPool) { return; };
+            if (value > 0ull) { this->wait(value); };
+            for (auto& submission : submissions) { device->dispatch->FreeCommandBuffers(commandPool, 1u, &submission.commandBuffer); };
+            this->submissions.resize(0u);
+            device->dispatch->DestroyCommandPool(commandPool, nullptr);
+            device->dispatch->DestroySemaphore(semaphore, nullptr);
+        };
+
+        //
+        virtual VkSemaphore getSemaphore() const {
+            return semaphore;
+        };
+
+        // value, which will be signaled by next submit
+        virtual uint64_t getNextValue() const {
+            return value + 1ull;
+        };
+
+        //
+        virtual uint64_t getCompletedValue()
+        {
+            uint64_t completed = 0ull;
+            vkt::handleVk(device->dispatch->GetSemaphoreCounterValue(semaphore, &completed));
+            return completed;
+        };
+
+        //
+        virtual bool isComplete(uint64_t value) {
+            return this->getCompletedValue() >= value;
+        };
+
+        // blocking, only when result needed on host
+        virtual void wait(uint64_t value)
+        {
+            VkSemaphoreWaitInfo waitInfo = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                .pNext = nullptr,
+                .flags = 0u,
+                .semaphoreCount = 1u,
+                .pSemaphores = &semaphore,
+                .pValues = &value
+            };
+            vkt::handleVk(device->dispatch->WaitSemaphores(&waitInfo, std::numeric_limits<uint64_t>::max()));
+        };
+
+        // packed into staging arena, copied with next submit
+        virtual uint64_t uploadIntoBuffer(vkh::VkDescriptorBufferInfo buffer, const void* data, VkDeviceSize size, VkPipelineStageFlags consumerStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+        {
+            this->currentBatch()->pushUpload(buffer, data, size);
+            this->batchStages |= consumerStages;
+            return this->getNextValue();
+        };
+
+        // with other family device buffer still owned by consumer, so dirty ranges left for regular upload (returns zero)
+        // uses slice selected by frame (selectStaging), so should be submitted before next frame selects other slice
+        template<class T>
+        uint64_t uploadDataSet(vkh::uni_ptr<DataSet<T>> dataSet, const std::vector<T>& data, VkPipelineStageFlags consumerStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+        {
+            if (!this->isSameFamily() || !dataSet->isDirty()) { return 0ull; };
+
+            // slice still read by earlier submit of same frame is rewritten only after it signaled
+            if (dataSet->getStagingGuard().semaphore == semaphore && dataSet->getStagingGuard().value <= value) { dataSet->waitStagingGuard(); };
+            dataSet->copyFromVector(data);
+            dataSet->setStagingGuard(this->getSemaphore(), this->getNextValue());
+            this->currentBatch()->pushDataSet(dataSet);
+            this->batchStages |= consumerStages;
+            return this->getNextValue();
+        };
+
+        // release completed command buffers and staging
+        virtual void recycle()
+        {
+            const uint64_t completed = this->getCompletedValue();
+            for (auto it = submissions.begin(); it != submissions.end();) {
+                if (it->value > completed) { it++; continue; };
+                device->dispatch->FreeCommandBuffers(commandPool, 1u, &it->commandBuffer);
+                it->batch->reset();
+                this->freeBatches.push_back(it->batch);
+                it = submissions.erase(it);
+            };
+        };
+
+        //
+        virtual uint64_t submit()
+        {
+            this->recycle();
+            if (!batch.has() || batch->isEmpty()) { return value; };
+
+            //
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            VkCommandBufferAllocateInfo allocateInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .pNext = nullptr,
+                .commandPool = commandPool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1u
+            };
+            vkt::handleVk(device->dispatch->AllocateCommandBuffers(&allocateInfo, &commandBuffer));
+
+            //
+            VkCommandBufferBeginInfo beginInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .pNext = nullptr,
+                .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                .pInheritanceInfo = nullptr
+            };
+            vkt::handleVk(device->dispatch->BeginCommandBuffer(commandBuffer, &beginInfo));
+            batch->cmdCopies(commandBuffer);
+
+            // release ownership to consumer family (acquired by Renderer)
+            if (!this->isSameFamily()) {
+                std::vector<VkBufferMemoryBarrier> releases = {};
+                for (auto& destination : batch->getDestinations()) {
+                    releases.push_back(VkBufferMemoryBarrier{
+                        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                        .pNext = nullptr,
+                        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = 0u,
+                        .srcQueueFamilyIndex = info.queueFamilyIndex,
+                        .dstQueueFamilyIndex = info.graphicsFamilyIndex,
+                        .buffer = destination.buffer,
+                        .offset = destination.offset,
+                        .size = destination.range
+                    });
+                };
+                device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0u, 0u, nullptr, uint32_t(releases.size()), releases.data(), 0u, nullptr);
+
+                //
+                for (auto& release : releases) {
+                    release.srcAccessMask = 0u;
+                    release.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+                    this->acquires.push_back(release);
+                };
+            };
+            vkt::handleVk(device->dispatch->EndCommandBuffer(commandBuffer));
+
+            //
+            this->value++;
+            VkTimelineSemaphoreSubmitInfo timelineInfo = {
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .pNext = nullptr,
+                .waitSemaphoreValueCount = 0u,
+                .pWaitSemaphoreValues = nullptr,
+                .signalSemaphoreValueCount = 1u,
+                .pSignalSemaphoreValues = &value
+            };
+            VkSubmitInfo submitInfo = {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext = &timelineInfo,
+                .waitSemaphoreCount = 0u,
+                .pWaitSemaphores = nullptr,
+                .pWaitDstStageMask = nullptr,
+                .commandBufferCount = 1u,
+                .pCommandBuffers = &commandBuffer,
+                .signalSemaphoreCount = 1u,
+                .pSignalSemaphores = &semaphore
+            };
+            vkt::handleVk(device->dispatch->QueueSubmit(queue, 1u, &submitInfo, VK_NULL_HANDLE));
+
+            //
+            this->submissions.push_back(Submission{ .commandBuffer = commandBuffer, .value = value, .batch = batch });
+            this->pending = AsyncTransferWait{ .semaphore = semaphore, .value = value, .stages = pending.stages | batchStages };
+            this->batch = vkh::uni_ptr<TransferBatch>{};
+            this->batchStages = 0u;
+            return value;
+        };
+
+        // wait for consumer submit, reset after taken (zero semaphore when nothing pending)
+        virtual AsyncTransferWait takeWait()
+        {
+            auto wait = this->pending;
+            this->pending = AsyncTransferWait{};
+            return wait;
+        };
+
+        // acquire ownership on consumer queue, recorded into submit which waits semaphore
+        virtual void cmdAcquire(VkCommandBuffer commandBuffer, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+        {
+            if (acquires.size() <= 0ull) { return; };
+            device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, stages, 0u, 0u, nullptr, uint32_t(acquires.size()), acquires.data(), 0u, nullptr);
+            this->acquires.resize(0u);
+        };
+    };
+
+};
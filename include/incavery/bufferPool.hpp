@@ -0,0 +1,180 @@
+#pragma once
+
+//
+#include <glm/glm.hpp>
+#include <vkf/swapchain.hpp>
+#include <map>
+#include <tuple>
+#include <mutex>
+
+//
+namespace icv {
+
+    //
+    struct BufferPoolInfo
+    {
+        VkBufferUsageFlags usage = 0u;
+        VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
+        VkDeviceSize blockSize = 64ull * 1024ull * 1024ull;
+        VkDeviceSize alignment = 256ull; // covers storage, uniform and indirect offsets
+    };
+
+    // suballocator over large buffers, for many small ones (one pool per usage)
+    class BufferPool
+    {
+        protected:
+        struct Block {
+            std::shared_ptr<vkf::VmaBufferAllocation> allocation = {};
+            vkf::VectorBase buffer = {};
+            VkDeviceSize size = 0ull;
+            std::map<VkDeviceSize, VkDeviceSize> freeRanges = {}; // offset, size
+            std::map<VkDeviceSize, VkDeviceSize> usedRanges = {}; // offset, size
+        };
+
+        //
+        vkh::uni_ptr<vkf::Device> device = {};
+        BufferPoolInfo info = {};
+        std::vector<Block> blocks = {};
+        std::mutex mutex = {};
+
+        // pools by allocator, usage and memory, and owner of every block (registry only observes, pools are owned by their users, so destroyed before device)
+        using PoolKey = std::tuple<uintptr_t, VkBufferUsageFlags, VmaMemoryUsage>;
+        static std::map<PoolKey, std::weak_ptr<BufferPool>>& pools() { static std::map<PoolKey, std::weak_ptr<BufferPool>> pools = {}; return pools; };
+        static std::map<VkBuffer, BufferPool*>& owners() { static std::map<VkBuffer, BufferPool*> owners = {}; return owners; };
+        static std::mutex& registryMutex() { static std::mutex mutex = {}; return mutex; };
+
+        //
+        virtual Block& createBlock(VkDeviceSize size)
+        {
+            auto bufferCreateInfo = vkh::VkBufferCreateInfo{
+                .size = size,
+                .usage = info.usage
+            };
+            auto vmaCreateInfo = vkf::VmaMemoryInfo{
+                .memUsage = info.memoryUsage,
+                .instanceDispatch = device->instance->dispatch,
+                .deviceDispatch = device->dispatch
+            };
+            auto allocation = std::make_shared<vkf::VmaBufferAllocation>(device->allocator, bufferCreateInfo, vmaCreateInfo);
+
+            //
+            auto& block = blocks.emplace_back();
+            block.allocation = allocation;
+            block.buffer = vkf::VectorBase(allocation, 0ull, size, sizeof(uint8_t));
+            block.size = size;
+            block.freeRanges[0ull] = size;
+            {
+                std::lock_guard<std::mutex> lock(registryMutex());
+                owners()[VkBuffer(block.buffer)] = this;
+            };
+            return block;
+        };
+
+        // first fit, rest of range stays free
+        virtual bool allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize& offset)
+        {
+            for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); it++) {
+                if (it->second < size) { continue; };
+                offset = it->first;
+                const VkDeviceSize rest = it->second - size;
+                block.freeRanges.erase(it);
+                if (rest > 0ull) { block.freeRanges[offset + size] = rest; };
+                block.usedRanges[offset] = size;
+                return true;
+            };
+            return false;
+        };
+
+        //
+        virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<BufferPoolInfo> info = BufferPoolInfo{})
+        {
+            this->info = info;
+            this->device = device;
+        };
+
+        public:
+        BufferPool() {};
+        BufferPool(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<BufferPoolInfo> info = BufferPoolInfo{}) { this->constructor(device, info); };
+
+        //
+        ~BufferPool() {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            for (auto& block : blocks) { owners().erase(VkBuffer(block.buffer)); };
+        };
+
+        // shared pool of device allocator, alive while any user holds it
+        static std::shared_ptr<BufferPool> get(vkh::uni_ptr<vkf::Device> device, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY)
+        {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            auto& observed = pools()[PoolKey{ uintptr_t(device->allocator), usage, memoryUsage }];
+            auto pool = observed.lock();
+            if (!pool) { observed = pool = std::make_shared<BufferPool>(device, BufferPoolInfo{ .usage = usage, .memoryUsage = memoryUsage }); };
+            return pool;
+        };
+
+        // return region into pool, which owns that buffer (if pooled)
+        static bool release(vkh::VkDescriptorBufferInfo buffer)
+        {
+            BufferPool* pool = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(registryMutex());
+                auto it = owners().find(buffer.buffer);
+                if (it == owners().end()) { return false; };
+                pool = it->second;
+            };
+            return pool->free(buffer.buffer, buffer.offset);
+        };
+
+        //
+        virtual vkf::VectorBase allocate(VkDeviceSize size, VkDeviceSize stride = sizeof(uint8_t))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const VkDeviceSize alignedSize = std::max(((size + info.alignment - 1ull) / info.alignment) * info.alignment, info.alignment);
+
+            //
+            VkDeviceSize offset = 0ull;
+            for (auto& block : blocks) {
+                if (this->allocateFromBlock(block, alignedSize, offset)) {
+                    return vkf::VectorBase(block.allocation, offset, size, stride);
+                };
+            };
+
+            // too large gets own block
+            auto& block = this->createBlock(std::max(alignedSize, info.blockSize));
+            this->allocateFromBlock(block, alignedSize, offset);
+            return vkf::VectorBase(block.allocation, offset, size, stride);
+        };
+
+        // merge with neighbour free ranges
+        virtual bool free(VkBuffer buffer, VkDeviceSize offset)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& block : blocks) {
+                if (VkBuffer(block.buffer) != buffer) { continue; };
+
+                auto used = block.usedRanges.find(offset);
+                if (used == block.usedRanges.end()) { return false; };
+                VkDeviceSize size = used->second;
+                block.usedRanges.erase(used);
+
+                //
+                auto next = block.freeRanges.lower_bound(offset);
+                if (next != block.freeRanges.end() && next->first == (offset + size)) {
+                    size += next->second;
+                    next = block.freeRanges.erase(next);
+                };
+                if (next != block.freeRanges.begin()) {
+                    auto prev = std::prev(next);
+                    if ((prev->first + prev->second) == offset) {
+                        prev->second += size;
+                        return true;
+                    };
+                };
+                block.freeRanges[offset] = size;
+                return true;
+            };
+            return false;
+        };
+    };
+
+};
@@ -3,10 +3,25 @@
 // 
 #include <glm/glm.hpp>
 #include <vkf/swapchain.hpp>
+#include <algorithm>
+#include "./bufferPool.hpp"
 
 // 
 namespace icv {
 
+    // FNV-1a, for cache keys and content deduplication
+    inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) { hash = (hash ^ bytes[i]) * 1099511628211ull; };
+        return hash;
+    };
+
+    // only for types without padding
+    template<class T>
+    inline uint64_t hashCombine(uint64_t hash, const T& value) {
+        return hashBytes(&value, sizeof(T), hash);
+    };
+
     //
     struct DescriptorInfo {
         VkDescriptorSetLayout layout = VK_NULL_HANDLE;
@@ -42,6 +57,7 @@ namespace icv {
         VkDeviceSize size = 16ull;
         VkDeviceSize stride = sizeof(uint8_t);
         VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
+        bool pooled = false; // suballocate from shared pool, for small buffers
     };
 
     //
@@ -54,6 +70,47 @@ namespace icv {
     };
 
     // 
+    enum class BuildQuality : uint32_t {
+        Auto = 0u, // fast build, promoted to fast trace when static
+        FastTrace = 1u,
+        FastBuild = 2u,
+        LowMemory = 3u
+    };
+
+    // acceleration structure build flags of level
+    struct BuildPolicy
+    {
+        BuildQuality quality = BuildQuality::Auto;
+        bool allowCompaction = false; // for static geometry, rebuild after compaction needs re-make
+        bool allowUpdate = false; // refit when only vertices changed
+        uint32_t rebuildThreshold = 16u; // refits before full rebuild (zero is never)
+        uint32_t promoteAfterFrames = 60u; // static frames before promotion of auto quality
+    };
+
+    // resource replaced while recording frame (or timeline value), may be still used by GPU until that frame is completed
+    template<class T>
+    struct Retired
+    {
+        T value = {};
+        uint64_t frame = 0ull;
+    };
+
+    // handle with own storage
+    struct AccelerationStorage
+    {
+        VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+        vkf::VectorBase storage = {};
+    };
+
+    // passes resources of completed frames into release, others are kept
+    template<class T, class F>
+    inline void releaseCompleted(std::vector<Retired<T>>& retired, uint64_t completedFrame, F&& release) {
+        std::vector<Retired<T>> pending = {};
+        for (auto& entry : retired) { if (entry.frame <= completedFrame) { release(entry.value); } else { pending.push_back(std::move(entry)); }; };
+        retired = std::move(pending);
+    };
+
+    //
     enum class IndexType : uint32_t {
         None = 0u,
         Uint32 = 1u,
@@ -68,7 +125,13 @@ namespace icv {
         vkh::uni_ptr<vkf::Device> device = {};
         vkh::VkAccelerationStructureDeviceAddressInfoKHR deviceAddressInfo = {};
         vkh::VkBufferDeviceAddressInfo bufferAddressInfo = {};
-        
+
+        // pools which regions were allocated by this object (released with it, before device)
+        std::vector<std::shared_ptr<BufferPool>> bufferPools = {};
+
+        // frame (or timeline value) of commands being recorded, tags retired resources
+        uint64_t recordingFrame = 0ull;
+
         //
         virtual VkDeviceAddress bufferDeviceAddress(vkh::VkDescriptorBufferInfo buffer) 
         {
@@ -82,6 +145,11 @@ namespace icv {
                 .size = info->size,
                 .usage = (info->memoryUsage == VMA_MEMORY_USAGE_GPU_ONLY ? VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT : 0u) | VkBufferUsageFlags(info->usage)
             };
+            if (info->pooled) {
+                auto pool = BufferPool::get(device, bufferCreateInfo.usage, info->memoryUsage);
+                if (std::find(bufferPools.begin(), bufferPools.end(), pool) == bufferPools.end()) { this->bufferPools.push_back(pool); };
+                return pool->allocate(info->size);
+            };
             auto vmaCreateInfo = vkf::VmaMemoryInfo{
                 .memUsage = info->memoryUsage,
                 .instanceDispatch = device->instance->dispatch,
@@ -91,6 +159,12 @@ namespace icv {
             return vkf::VectorBase(allocation, 0ull, info->size, sizeof(uint8_t));
         };
 
+        // pooled regions are returned into pool, others freed with last reference
+        virtual bool releaseBuffer(vkh::VkDescriptorBufferInfo buffer) 
+        {   // 
+            return buffer.buffer ? BufferPool::release(buffer) : false;
+        };
+
         //
         virtual vkf::ImageRegion createImage2D(vkh::uni_arg<ImageCreateInfo> info)
         {   // 
@@ -127,6 +201,18 @@ namespace icv {
             return vkf::ImageRegion(allocation, imageViewCreateInfo, info->isDepth?VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:VK_IMAGE_LAYOUT_GENERAL);
         };
 
+        // 
+        virtual VkBuildAccelerationStructureFlagsKHR getBuildFlags(const BuildPolicy& policy, bool promoted = false)
+        {   // 
+            VkBuildAccelerationStructureFlagsKHR flags = 0u;
+            if (policy.quality == BuildQuality::FastTrace || (policy.quality == BuildQuality::Auto && promoted)) { flags |= VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR; };
+            if (policy.quality == BuildQuality::FastBuild || (policy.quality == BuildQuality::Auto && !promoted)) { flags |= VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR; };
+            if (policy.quality == BuildQuality::LowMemory) { flags |= VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR; };
+            if (policy.allowCompaction || policy.quality == BuildQuality::LowMemory) { flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR; };
+            if (policy.allowUpdate) { flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR; };
+            return flags;
+        };
+
         // 
         virtual VkIndexType getIndexType(IndexType indexType = IndexType::None)
         {   // 
@@ -136,6 +222,12 @@ namespace icv {
             if (indexType == IndexType::Uint8) { return VK_INDEX_TYPE_UINT8_EXT; };
             return VK_INDEX_TYPE_NONE_KHR;
         };
+
+        public:
+        // before recording of frame, resources retired by it are released by releaseRetired(frame) after completion
+        virtual void setRecordingFrame(uint64_t frame) {
+            this->recordingFrame = frame;
+        };
     };
 
 };
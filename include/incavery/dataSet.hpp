@@ -10,9 +10,34 @@
 // 
 namespace icv {
 
+    // 
+    enum class DataSetMemory : uint32_t {
+        Auto = 0u,    // same as staging
+        Staging = 1u, // cpu cache with copy into device local buffer
+        Direct = 2u   // write in place into persistently mapped buffer (opt-in, writes race with frames in flight)
+    };
+
     struct DataSetInfo {
-        size_t count = 0ull;
+        size_t count = 0ull; // initial capacity, grows when needed
         FLAGS(VkBufferUsage) usage = vkh::VkBufferUsageFlags{};
+
+        // staging slices, one per frame in flight
+        uint32_t stagingCount = 1u;
+
+        // direct mode has no staging, so writes are visible to frames in flight
+        DataSetMemory memory = DataSetMemory::Auto;
+    };
+
+    // timeline value that must be reached before staging slice reuse
+    struct StagingGuard {
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        uint64_t value = 0ull;
+    };
+
+    // range of elements (not bytes) changed since last upload
+    struct DataSetRange {
+        uintptr_t offset = 0ull;
+        uintptr_t count = 0ull;
     };
 
     class DataSetBase: public DeviceBased
@@ -29,6 +54,12 @@ namespace icv {
         public:
         DataSetBase() {};
         DataSetBase(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<DataSetInfo> info = DataSetInfo{}) { this->constructor(device, info); };
+
+        // used by upload batching, without element type
+        virtual bool isDirty() const { return false; };
+        virtual uint64_t getGeneration() const { return 0ull; };
+        virtual vkh::VkDescriptorBufferInfo getDestination() { return vkh::VkDescriptorBufferInfo{}; };
+        virtual void cmdCopyFromCpu(VkCommandBuffer commandBuffer) {};
     };
 
     template<class T = uint8_t>
@@ -37,16 +68,96 @@ namespace icv {
         protected:
         vkf::Vector<T> cpuCache = {};
         vkf::Vector<T> deviceBuffer = {};
-        
+
+        // staging ring, `cpuCache` is current slice
+        std::vector<vkf::Vector<T>> stagingRing = {};
+        std::vector<StagingGuard> stagingGuards = {};
+        uint32_t stagingIndex = 0u;
+
+        // ranges of current slice, and by slice ranges uploaded from other slices since its last use (made dirty again when selected)
+        std::vector<DataSetRange> dirtyRanges = {};
+        std::vector<std::vector<DataSetRange>> pendingRanges = {};
+        bool coalesced = true;
+
+        // buffer before growth, contents copied on device by next upload
+        vkf::Vector<T> previousBuffer = {};
+        size_t previousCount = 0ull;
+
+        // replaced staging slices and device buffers, may be still read by frames in flight (freed by releaseRetired)
+        std::vector<Retired<vkf::Vector<T>>> retired = {};
+        uint64_t generation = 0ull;
+
+        // sort and merge overlapping or adjacent ranges
+        static void mergeRanges(std::vector<DataSetRange>& ranges) {
+            std::sort(ranges.begin(), ranges.end(), [](const DataSetRange& a, const DataSetRange& b) { return a.offset < b.offset; });
+
+            uintptr_t last = 0ull;
+            for (uintptr_t i = 1; i < ranges.size(); i++) {
+                auto& merged = ranges[last];
+                if (ranges[i].offset <= (merged.offset + merged.count)) {
+                    merged.count = std::max(merged.offset + merged.count, ranges[i].offset + ranges[i].count) - merged.offset;
+                } else {
+                    ranges[++last] = ranges[i];
+                };
+            };
+            if (ranges.size() > 0ull) { ranges.resize(last + 1u); };
+        };
+
+        //
+        virtual void coalesceRanges() {
+            if (coalesced) { return; };
+            mergeRanges(dirtyRanges);
+            coalesced = true;
+        };
+
+        // ranges past end of data are dropped or cut, so only copied elements are uploaded
+        virtual void clampRanges(size_t count) {
+            this->coalesceRanges();
+            while (dirtyRanges.size() > 0ull && dirtyRanges.back().offset >= count) { dirtyRanges.pop_back(); };
+            if (dirtyRanges.size() > 0ull) { dirtyRanges.back().count = std::min(dirtyRanges.back().count, uintptr_t(count) - dirtyRanges.back().offset); };
+        };
+
+        // 
+        virtual void allocateBuffers(size_t count) {
+            count = std::max(count, size_t(1u));
+
+            // single mapped buffer, without copy
+            if (this->info.memory == DataSetMemory::Direct) {
+                this->deviceBuffer = vkf::Vector<T>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VkBufferUsageFlags(info.usage), .size = sizeof(T) * count, .stride = sizeof(T), .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU }));
+                this->stagingRing = { this->deviceBuffer };
+                this->stagingGuards.resize(1u);
+                this->pendingRanges.resize(1u);
+                this->stagingIndex = 0u;
+                this->cpuCache = this->deviceBuffer;
+                return;
+            };
+
+            // 
+            this->stagingRing.resize(std::max(info.stagingCount, 1u));
+            this->stagingGuards.resize(this->stagingRing.size());
+            this->pendingRanges.resize(this->stagingRing.size());
+            for (auto& staging : this->stagingRing) {
+                staging = vkf::Vector<T>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, .size = sizeof(T) * count, .stride = sizeof(T), .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU }));
+            };
+            this->stagingIndex = std::min(this->stagingIndex, uint32_t(this->stagingRing.size() - 1u));
+            this->cpuCache = this->stagingRing[this->stagingIndex];
+            this->deviceBuffer = vkf::Vector<T>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VkBufferUsageFlags(info.usage), .size = sizeof(T) * count, .stride = sizeof(T), .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY }));
+        };
 
         // 
         virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<DataSetInfo> info = DataSetInfo{}) {
             this->info = info;
             this->device = device;
 
-            // 
-            this->cpuCache = vkf::Vector<T>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, .size = sizeof(T) * info->count, .stride = sizeof(T), .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU }));
-            this->deviceBuffer = vkf::Vector<T>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VkBufferUsageFlags(info->usage), .size = sizeof(T) * info->count, .stride = sizeof(T), .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY }));
+            // direct write changes contents read by frames in flight, so it's never chosen implicitly
+            if (this->info.memory == DataSetMemory::Auto) {
+                this->info.memory = DataSetMemory::Staging;
+            };
+
+            // first upload is always full
+            this->info.count = std::max(this->info.count, size_t(1u));
+            this->allocateBuffers(this->info.count);
+            this->markAllDirty();
         };
         
         public:
@@ -83,33 +194,226 @@ namespace icv {
             return deviceBuffer;
         };
 
+        // select staging slice of frame in flight (caller already waited that frame, async upload of slice is waited here), changes it missed are uploaded again
+        virtual void selectStaging(uint32_t frameIndex) {
+            this->stagingIndex = frameIndex % uint32_t(stagingRing.size());
+            this->cpuCache = stagingRing[stagingIndex];
+            this->waitStagingGuard();
+            for (auto& range : pendingRanges[stagingIndex]) { this->markDirty(range.offset, range.count); };
+            this->pendingRanges[stagingIndex].resize(0u);
+        };
+
+        // waits submission which reads current slice, when guarded (its value should be already submitted)
+        virtual void waitStagingGuard() {
+            auto& guard = stagingGuards[stagingIndex];
+            if (guard.semaphore) {
+                VkSemaphoreWaitInfo waitInfo = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                    .pNext = nullptr,
+                    .flags = 0u,
+                    .semaphoreCount = 1u,
+                    .pSemaphores = &guard.semaphore,
+                    .pValues = &guard.value
+                };
+                vkt::handleVk(device->dispatch->WaitSemaphores(&waitInfo, std::numeric_limits<uint64_t>::max()));
+                guard = StagingGuard{};
+            };
+        };
+
+        // timeline value signaled by submission which reads current slice
+        virtual void setStagingGuard(VkSemaphore semaphore, uint64_t value) {
+            stagingGuards[stagingIndex] = StagingGuard{ .semaphore = semaphore, .value = value };
+        };
+
+        //
+        virtual const StagingGuard& getStagingGuard() const {
+            return stagingGuards[stagingIndex];
+        };
+
+        //
+        virtual uint32_t getStagingIndex() const {
+            return stagingIndex;
+        };
+
+        //
+        virtual uint32_t getStagingCount() const {
+            return uint32_t(stagingRing.size());
+        };
+
+        // grow capacity geometrically, device contents are kept
+        virtual bool reserve(size_t count) {
+            if (count <= info.count) { return false; };
+
+            // older buffer already holds everything valid, when copy still pending
+            const size_t oldCount = info.count;
+            auto oldRing = this->stagingRing;
+            if (previousCount == 0ull && !this->isDirectWrite()) {
+                this->previousBuffer = this->deviceBuffer;
+                this->previousCount = oldCount;
+            } else 
+            if (!this->isDirectWrite()) {
+                this->retired.push_back(Retired<vkf::Vector<T>>{ this->deviceBuffer, recordingFrame });
+            };
+
+            // 
+            this->info.count = std::max(count, oldCount * size_t(2u));
+            this->allocateBuffers(info.count);
+            this->generation++;
+
+            // keep cached writes of every slice, not only current one (in direct mode it's whole contents)
+            for (uintptr_t i = 0; i < std::min(oldRing.size(), stagingRing.size()); i++) {
+                memcpy(&stagingRing[i][0u], &oldRing[i][0u], oldCount * sizeof(T));
+            };
+            for (auto& staging : oldRing) { this->retired.push_back(Retired<vkf::Vector<T>>{ staging, recordingFrame }); };
+            return true;
+        };
+
+        // buffers retired by frames up to completed one
+        virtual void releaseRetired(uint64_t completedFrame) {
+            releaseCompleted(retired, completedFrame, [](vkf::Vector<T>&) {});
+        };
+
+        // changed when device buffer (and address) was reallocated
+        virtual uint64_t getGeneration() const {
+            return generation;
+        };
+
+        //
+        virtual size_t getCapacity() const {
+            return info.count;
+        };
+
+        // mark elements for next upload
+        virtual void markDirty(uintptr_t index, uintptr_t count = 1ull) {
+            if (count == 0ull) { return; };
+            if ((index + count) > info.count) { this->reserve(index + count); };
+
+            // cheap merge with last range, for sequential writes
+            if (dirtyRanges.size() > 0ull && coalesced) {
+                auto& last = dirtyRanges.back();
+                if (index >= last.offset && index <= (last.offset + last.count)) {
+                    last.count = std::max(last.offset + last.count, index + count) - last.offset;
+                    return;
+                };
+                if (index < last.offset) { coalesced = false; };
+            };
+            dirtyRanges.push_back(DataSetRange{ .offset = index, .count = count });
+        };
+
+        //
+        virtual void markAllDirty() {
+            dirtyRanges.resize(1u);
+            dirtyRanges[0u] = DataSetRange{ .offset = 0ull, .count = uintptr_t(info.count) };
+            coalesced = true;
+        };
+
         //
+        virtual bool isDirty() const {
+            return dirtyRanges.size() > 0ull;
+        };
+
+        //
+        virtual const std::vector<DataSetRange>& getDirtyRanges() {
+            this->coalesceRanges();
+            return dirtyRanges;
+        };
+
+        // copy only dirty elements into cache
         virtual void copyFromVector(const std::vector<T>& data) {
-            memcpy(cpuCache.mapped(), data.data(), std::min(data.size() * sizeof(T), cpuCache.range()));
+            this->reserve(data.size());
+            this->clampRanges(data.size());
+            for (auto& range : dirtyRanges) {
+                memcpy(&cpuCache[range.offset], &data[range.offset], range.count * sizeof(T));
+            };
         };
 
         //
-        virtual void cmdCopyFromCpu(VkCommandBuffer commandBuffer) {
-            VkBufferCopy2KHR srcCopy = {
+        virtual vkh::VkDescriptorBufferInfo getDestination() {
+            return deviceBuffer;
+        };
+
+        //
+        virtual bool isDirectWrite() const {
+            return info.memory == DataSetMemory::Direct;
+        };
+
+        // move contents of buffer before growth
+        virtual void cmdCopyFromPrevious(VkCommandBuffer commandBuffer) {
+            if (previousCount == 0ull) { return; };
+
+            VkBufferCopy2KHR region = {
                 .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2_KHR,
                 .pNext = nullptr,
-                .srcOffset = cpuCache.offset(),
+                .srcOffset = previousBuffer.offset(),
                 .dstOffset = deviceBuffer.offset(),
-                .size = std::min(deviceBuffer.range(), deviceBuffer.range())
+                .size = previousCount * sizeof(T)
+            };
+            VkCopyBufferInfo2KHR copyInfo = {
+                .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2_KHR,
+                .pNext = nullptr,
+                .srcBuffer = previousBuffer,
+                .dstBuffer = deviceBuffer,
+                .regionCount = 1u,
+                .pRegions = &region
             };
+            device->dispatch->CmdCopyBuffer2KHR(commandBuffer, &copyInfo);
+
+            // dirty ranges overwrite moved contents
+            VkMemoryBarrier memoryBarrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+            };
+            device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+
+            // keep alive while command is pending
+            this->retired.push_back(Retired<vkf::Vector<T>>{ this->previousBuffer, recordingFrame });
+            this->previousBuffer = vkf::Vector<T>{};
+            this->previousCount = 0ull;
+        };
+
+        // one copy command with region per dirty range
+        virtual void cmdCopyFromCpu(VkCommandBuffer commandBuffer) {
+            this->coalesceRanges();
+            this->cmdCopyFromPrevious(commandBuffer);
+            if (this->isDirectWrite()) { dirtyRanges.resize(0u); return; };
+            if (dirtyRanges.size() <= 0ull) { return; };
+
+            std::vector<VkBufferCopy2KHR> regions = {};
+            for (auto& range : dirtyRanges) {
+                regions.push_back(VkBufferCopy2KHR{
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2_KHR,
+                    .pNext = nullptr,
+                    .srcOffset = cpuCache.offset() + range.offset * sizeof(T),
+                    .dstOffset = deviceBuffer.offset() + range.offset * sizeof(T),
+                    .size = range.count * sizeof(T)
+                });
+            };
+
             VkCopyBufferInfo2KHR copyInfo = {
                 .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2_KHR,
                 .pNext = nullptr,
                 .srcBuffer = cpuCache,
                 .dstBuffer = deviceBuffer,
-                .regionCount = 1,
-                .pRegions = &srcCopy
+                .regionCount = uint32_t(regions.size()),
+                .pRegions = regions.data()
             };
             device->dispatch->CmdCopyBuffer2KHR(commandBuffer, &copyInfo);
+
+            // other slices still hold previous contents of these ranges
+            for (uint32_t i = 0u; i < pendingRanges.size(); i++) {
+                if (i == stagingIndex) { continue; };
+                this->pendingRanges[i].insert(pendingRanges[i].end(), dirtyRanges.begin(), dirtyRanges.end());
+                mergeRanges(pendingRanges[i]);
+            };
+            dirtyRanges.resize(0u);
+            coalesced = true;
         };
 
         //
         virtual void copyFromCpu(vkh::uni_ptr<vkf::Queue> queue) {
+            if (this->isDirectWrite() && previousCount == 0ull) { dirtyRanges.resize(0u); return; };
             queue->submitOnce([&,this](VkCommandBuffer commandBuffer){
                 this->cmdCopyFromCpu(commandBuffer);
             });
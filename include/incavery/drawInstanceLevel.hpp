@@ -57,7 +57,9 @@ namespace icv {
 
         // 
         std::vector<DrawInstance> instances = {};
-        uint32_t maxInstanceCount = 128u;
+        uint32_t maxInstanceCount = 128u; // initial capacity, grows when exceeded
+        uint32_t stagingCount = 1u;
+        DataSetMemory memory = DataSetMemory::Auto;
     };
 
     // 
@@ -69,6 +71,7 @@ namespace icv {
 
         // 
         std::vector<vkf::Vector<VkDrawIndirectCommand>> indirectDrawBuffers = {};
+        std::vector<Retired<vkf::VectorBase>> retiredBuffers = {}; // may be still read by frames in flight (returned by releaseRetired)
         //std::vector<vkh::uni_ptr<DataSet<VkDrawIndirectCommand>>> indirectDrawBuffers = {};
         vkh::uni_ptr<DataSet<DrawInstance>> instances = {};
 
@@ -76,6 +79,10 @@ namespace icv {
         VkDescriptorSet set = VK_NULL_HANDLE;
         bool created = false;
 
+        // for rewrite, when instance buffer grown
+        DescriptorInfo descriptorInfo = {};
+        uint64_t descriptorGeneration = 0ull;
+
         //
         virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<DrawInstanceLevelInfo> info = DrawInstanceLevelInfo{}) 
         {
@@ -83,7 +90,9 @@ namespace icv {
             this->device = device;
             this->instances = std::make_shared<DataSet<DrawInstance>>(device, DataSetInfo{
                 .count = info->maxInstanceCount,
-                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                .stagingCount = info->stagingCount,
+                .memory = info->memory
             });
 
             
@@ -103,16 +112,11 @@ namespace icv {
             return set;
         };
 
-        //
+        // read only, use changeInstance
         virtual const DrawInstanceLevelInfo& getInfo() const {
             return info;
         };
 
-        //
-        virtual DrawInstanceLevelInfo& getInfo() {
-            return info;
-        };
-
         //
         virtual vkf::Vector<VkDrawIndirectCommand>& getIndirectDrawBuffer(const intptr_t& I = 0u) {
             return indirectDrawBuffers[I];
@@ -124,20 +128,20 @@ namespace icv {
             auto indexedf = vkh::VkDescriptorBindingFlags{ .eUpdateAfterBind = 1, .eUpdateUnusedWhilePending = 1, .ePartiallyBound = 1 };
             auto dflags = vkh::VkDescriptorSetLayoutCreateFlags{ .eUpdateAfterBindPool = 1 };
 
-            {   // create descriptor set layout
-                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{});
+            {   // instance and indirect buffers are rewritten after bind
+                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{ .flags = dflags });
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 0u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     .descriptorCount = 1u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 1u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     .descriptorCount = 256u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 vkt::handleVk(device->dispatch->CreateDescriptorSetLayout(descriptorSetLayoutHelper.format(), nullptr, &descriptorSetLayout));
             };
             return descriptorSetLayout;
@@ -168,9 +172,17 @@ namespace icv {
             };
 
             vkt::AllocateDescriptorSetWithUpdate(device->dispatch, descriptorSetHelper, set, created);
+            this->descriptorInfo = info;
+            this->descriptorGeneration = instances->getGeneration();
             return set;
         };
 
+        // rewrite descriptor set, when instance buffer was reallocated
+        virtual void republishDescriptorSet() 
+        {   // 
+            if (created && descriptorGeneration != instances->getGeneration()) { this->makeDescriptorSet(descriptorInfo); };
+        };
+
 
         //
         virtual void setGeometryReferences(const std::vector<vkh::uni_ptr<GeometryLevel>>& geometries) {
@@ -179,14 +191,37 @@ namespace icv {
                 info.instances[i].acceptGeometryLevel(geometries[info.instances[i].geometryLevelId]);
             };
             this->createIndirectBuffers();
+            this->instances->markDirty(0ull, info.instances.size());
+        };
+
+        // few commands per instance, so suballocated from pool (reused when large enough, else previous region retired)
+        virtual void createIndirectBuffer(uintptr_t instanceId, uint32_t geometryLevelCount) {
+            if (this->indirectDrawBuffers.size() <= instanceId) { this->indirectDrawBuffers.resize(instanceId + 1u); };
+            if (this->indirectDrawBuffers[instanceId].range() >= (sizeof(VkDrawIndirectCommand) * geometryLevelCount) && geometryLevelCount > 0u) {
+                this->info.instances[instanceId].indirectDrawReference = this->indirectDrawBuffers[instanceId].deviceAddress();
+                return;
+            };
+            if (this->indirectDrawBuffers[instanceId].range() > 0ull) { this->retiredBuffers.push_back(Retired<vkf::VectorBase>{ this->indirectDrawBuffers[instanceId], recordingFrame }); };
+            this->indirectDrawBuffers[instanceId] = vkf::Vector<VkDrawIndirectCommand>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, .size = sizeof(VkDrawIndirectCommand) * geometryLevelCount, .stride = sizeof(VkDrawIndirectCommand), .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY, .pooled = true }));
+            this->info.instances[instanceId].indirectDrawReference = this->indirectDrawBuffers[instanceId].deviceAddress();
+        };
+
+        // retired by frames up to completed one, which used them
+        virtual void releaseRetired(uint64_t completedFrame) {
+            releaseCompleted(retiredBuffers, completedFrame, [this](vkf::VectorBase& retired) { this->releaseBuffer(retired); });
+            instances->releaseRetired(completedFrame);
+        };
+
+        //
+        virtual void setRecordingFrame(uint64_t frame) override {
+            this->recordingFrame = frame;
+            instances->setRecordingFrame(frame);
         };
 
         //
         virtual void createIndirectBuffers() {
-            if (this->indirectDrawBuffers.size() < this->info.instances.size()) { this->indirectDrawBuffers.resize(this->info.instances.size()); };
             for (uintptr_t I = 0; I < this->info.instances.size(); I++) {
-                this->indirectDrawBuffers[I] = vkf::Vector<VkDrawIndirectCommand>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, .size = sizeof(VkDrawIndirectCommand) * this->info.instances[I].geometryLevelCount, .stride = sizeof(VkDrawIndirectCommand), .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY }));
-                info.instances[I].indirectDrawReference = this->indirectDrawBuffers[I].deviceAddress();
+                this->createIndirectBuffer(I, this->info.instances[I].geometryLevelCount);
             };
         };
 
@@ -196,6 +231,7 @@ namespace icv {
         {
             {   // 
                 instances->copyFromVector(info.instances);
+                this->republishDescriptorSet();
                 instances->cmdCopyFromCpu(commandBuffer);
             };
         };
@@ -210,14 +246,26 @@ namespace icv {
             this->info.instances[instanceId] = info;
 
             if (info->geometryLevelCount > 0) {
-                if (this->indirectDrawBuffers.size() <= instanceId) { this->indirectDrawBuffers.resize(instanceId + 1u); };
-                this->indirectDrawBuffers[instanceId] = vkf::Vector<VkDrawIndirectCommand>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, .size = sizeof(VkDrawIndirectCommand) * info->geometryLevelCount, .stride = sizeof(VkDrawIndirectCommand), .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY }));
-                this->info.instances[instanceId].indirectDrawReference = this->indirectDrawBuffers[instanceId].deviceAddress();
+                this->createIndirectBuffer(instanceId, info->geometryLevelCount);
             };
 
+            this->instances->markDirty(instanceId);
             return instanceId;
         };
 
+        // transform only (e.g. by scene graph), uploaded after markDirty
+        virtual bool writeTransform(uintptr_t instanceId, const glm::mat3x4& transform)
+        {
+            if (this->info.instances.size() <= instanceId) { return false; };
+            this->info.instances[instanceId].transform = transform;
+            return true;
+        };
+
+        //
+        virtual void markDirty(uintptr_t instanceId, uintptr_t count = 1ull) {
+            this->instances->markDirty(instanceId, count);
+        };
+
         //
         virtual uintptr_t pushInstance(vkh::uni_arg<DrawInstance> info = DrawInstance{})
         {   // add instance into registry
@@ -227,15 +275,28 @@ namespace icv {
             this->info.instances.push_back(info);
 
             if (info->geometryLevelCount > 0) {
-                if (this->indirectDrawBuffers.size() <= instanceId) { this->indirectDrawBuffers.resize(instanceId + 1u); };
-                this->indirectDrawBuffers[instanceId] = vkf::Vector<VkDrawIndirectCommand>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, .size = sizeof(VkDrawIndirectCommand) * info->geometryLevelCount, .stride = sizeof(VkDrawIndirectCommand), .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY }));
-                this->info.instances[instanceId].indirectDrawReference = this->indirectDrawBuffers[instanceId].deviceAddress();
+                this->createIndirectBuffer(instanceId, info->geometryLevelCount);
             };
 
+            this->instances->markDirty(instanceId);
             return instanceId;
         };
 
 
+        // 
+        virtual void enqueueUpload(vkh::uni_ptr<TransferBatch> batch)
+        {   // 
+            instances->copyFromVector(info.instances);
+            this->republishDescriptorSet();
+            batch->pushDataSet(instances);
+        };
+
+        //
+        virtual void selectStaging(uint32_t frameIndex)
+        {   // 
+            instances->selectStaging(frameIndex);
+        };
+
         // 
         virtual void flush(vkh::uni_ptr<vkf::Queue> queue = {}) 
         {   // 
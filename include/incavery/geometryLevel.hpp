@@ -4,6 +4,9 @@
 #include "./core.hpp"
 #include "./geometryRegistry.hpp"
 #include "./dataSet.hpp"
+#include "./transferBatch.hpp"
+#include "./scratchArena.hpp"
+#include <functional>
 
 // 
 namespace icv {
@@ -68,6 +71,9 @@ namespace icv {
     };
 #pragma pack(pop)
 
+    // stride of geometry table, also used by shaders (GEOMETRY_INFO_SIZE) as transform offset
+    static_assert(sizeof(GeometryInfo) == 128u, "GeometryInfo layout should match GLSL");
+
 
     // 
     struct GeometryLevelInfo 
@@ -75,7 +81,14 @@ namespace icv {
         vkh::uni_ptr<GeometryRegistry> registry = {};
         std::vector<GeometryInfo> geometries = {};
 
-        uint32_t maxGeometryCount = 128u;
+        uint32_t maxGeometryCount = 128u; // initial capacity, grows when exceeded
+        BuildPolicy policy = {};
+        vkh::uni_ptr<ScratchArena> scratchArena = {}; // shared scratch, otherwise own (released after static build)
+        bool indirectBuild = false; // ranges from indirect build buffer, written by compute (seeded by CPU)
+        uint64_t contentHash = 0ull; // of vertex and index data, by application (zero disables acceleration cache)
+        bool narrowIndices = true; // ingested indices repacked into 16-bit, when largest index allows
+        uint32_t stagingCount = 1u;
+        DataSetMemory memory = DataSetMemory::Auto;
     };
 
     // 
@@ -88,7 +101,8 @@ namespace icv {
         BuildInfo buildInfo = {};
 
         // 
-        vkf::Vector<VkAccelerationStructureGeometryKHR> indirectBuildBuffer = {};
+        vkh::uni_ptr<DataSet<VkAccelerationStructureBuildRangeInfoKHR>> indirectRanges = {};
+        std::vector<uint32_t> maxPrimitiveCounts = {};
         vkh::uni_ptr<DataSet<GeometryInfo>> geometries = {};
         VkDescriptorSet set = VK_NULL_HANDLE;
         bool created = false;
@@ -97,23 +111,77 @@ namespace icv {
         VkAccelerationStructureKHR acceleration = VK_NULL_HANDLE;
         vkf::VectorBase accStorage = {};
         vkf::VectorBase accScratch = {};
+        std::vector<Retired<vkf::VectorBase>> retiredScratch = {}; // own scratch of recorded builds (released by releaseScratch or releaseRetired)
+
+        // geometry table generation used by build info, and own (changed by every re-make)
+        uint64_t builtGeneration = 0ull;
+        uint64_t generation = 0ull;
+
+        // needs build, and scratch size of it
+        bool dirty = true;
+        bool pendingSeed = true; // indirect ranges rewritten from CPU by next upload
+        VkDeviceSize scratchSize = 0ull;
+
+        // refit state of dynamic level
+        bool verticesChanged = false;
+        bool built = false;
+        uint32_t refitCount = 0u;
+        VkDeviceSize updateScratchSize = 0ull;
+        bool prepared = false; // mode of pending build already decided by prepareBuild
+
+        // auto quality, promoted to fast trace when static long enough (flags fixed until re-make)
+        uint32_t staticFrames = 0u;
+        bool promoted = false;
+        bool promotePending = false;
+
+        // compacted size query
+        VkQueryPool compactionQuery = VK_NULL_HANDLE;
+        bool compactionPending = false;
+        bool compacted = false;
+
+        // replaced by re-make, compaction or deserialization, may be still used by GPU (destroyed by releaseRetired)
+        std::vector<Retired<AccelerationStorage>> retiredAccelerations = {};
+
+        // repacked by ingest, by geometry (returned into pool when geometry replaced, or with level)
+        std::vector<vkf::VectorBase> indexBuffers = {};
+        std::vector<Retired<vkf::VectorBase>> retiredIndexBuffers = {};
+        uint64_t remappedGeneration = 0ull;
+        uint64_t remappedBindingGeneration = 0ull; // compaction of registry bindings
 
         //
         virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<GeometryLevelInfo> info = GeometryLevelInfo{}) 
         {
             this->info = info;
             this->device = device;
+            if (this->info.registry.has()) { // pointers and binding indices of new level are current
+                this->remappedGeneration = this->info.registry->getRelocationGeneration();
+                this->remappedBindingGeneration = this->info.registry->getCompactionGeneration();
+            };
+
             this->geometries = std::make_shared<DataSet<GeometryInfo>>(device, DataSetInfo{
                 .count = info->maxGeometryCount,
-                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                .stagingCount = info->stagingCount,
+                .memory = info->memory
+            });
+            this->indirectRanges = std::make_shared<DataSet<VkAccelerationStructureBuildRangeInfoKHR>>(device, DataSetInfo{
+                .count = info->maxGeometryCount,
+                .usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                .stagingCount = info->stagingCount,
+                .memory = info->memory
             });
-            this->indirectBuildBuffer = vkf::Vector<VkAccelerationStructureGeometryKHR>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, .size = sizeof(VkAccelerationStructureGeometryKHR) * info->maxGeometryCount, .stride = sizeof(VkAccelerationStructureGeometryKHR), .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY }));
         };
 
         public: 
         GeometryLevel() {};
         GeometryLevel(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<GeometryLevelInfo> info = GeometryLevelInfo{}) { this->constructor(device, info); };
 
+        // pooled index buffers, when no longer used by device
+        ~GeometryLevel() {
+            for (auto& buffer : indexBuffers) { if (buffer.range() > 0ull) { this->releaseBuffer(buffer); }; };
+            for (auto& retired : retiredIndexBuffers) { this->releaseBuffer(retired.value); };
+        };
+
         //
         virtual const VkDescriptorSet& getDescriptorSet() const {
             return set;
@@ -124,25 +192,20 @@ namespace icv {
             return set;
         };
 
-        //
+        // read only, geometries are changed by setGeometry
         virtual const GeometryLevelInfo& getInfo() const {
             return info;
         };
 
-        //
-        virtual GeometryLevelInfo& getInfo() {
-            return info;
-        };
-
 
-        //
-        virtual const vkf::Vector<VkAccelerationStructureGeometryKHR>& getIndirectBuildBuffer() const {
-            return indirectBuildBuffer;
+        // build ranges per geometry, for compute shaders
+        virtual const vkf::Vector<VkAccelerationStructureBuildRangeInfoKHR>& getIndirectBuildBuffer() const {
+            return indirectRanges->getDeviceBuffer();
         };
 
         //
-        virtual vkf::Vector<VkAccelerationStructureGeometryKHR>& getIndirectBuildBuffer() {
-            return indirectBuildBuffer;
+        virtual vkf::Vector<VkAccelerationStructureBuildRangeInfoKHR>& getIndirectBuildBuffer() {
+            return indirectRanges->getDeviceBuffer();
         };
 
 
@@ -156,9 +219,19 @@ namespace icv {
             return geometries->getDeviceBuffer();
         };
 
+        // when table reallocated or geometry count changed, addresses and sizes are stale
+        virtual bool isAccelerationStale() const {
+            return !acceleration || builtGeneration != geometries->getGeneration() || buildInfo.builds.size() != info.geometries.size() || (compacted && dirty) || promotePending;
+        };
+
+        // instances referencing this level should re-accept it, when changed
+        virtual uint64_t getGeneration() const {
+            return generation;
+        };
+
         //
         virtual VkDeviceAddress getDeviceAddress() {
-            if (!acceleration) { this->makeAccelerationStructure(); };
+            if (this->isAccelerationStale()) { this->makeAccelerationStructure(); };
             return device->dispatch->GetAccelerationStructureDeviceAddressKHR(&(deviceAddressInfo = acceleration));
         };
 
@@ -168,29 +241,483 @@ namespace icv {
         //    return device->dispatch->GetAccelerationStructureDeviceAddressKHR(&(deviceAddressInfo = acceleration));
         //};
 
-        // 
-        virtual void buildCommand(VkCommandBuffer commandBuffer) 
+        //
+        virtual bool isDirty() const {
+            return dirty || verticesChanged || geometries->isDirty() || this->isAccelerationStale();
+        };
+
+        // positions only, same topology (dynamic level refits)
+        virtual void markVerticesChanged() {
+            this->verticesChanged = true;
+            this->staticFrames = 0u;
+        };
+
+        //
+        virtual bool allowsCompaction() const {
+            return info.policy.allowCompaction || info.policy.quality == BuildQuality::LowMemory;
+        };
+
+        // once per frame, promotes auto quality level (re-made with fast trace)
+        virtual void advanceFrame() {
+            if (this->isDirty()) { this->staticFrames = 0u; return; };
+            this->staticFrames++;
+            if (info.policy.quality == BuildQuality::Auto && !promoted && staticFrames >= info.policy.promoteAfterFrames) {
+                this->promotePending = true;
+            };
+        };
+
+        //
+        virtual bool isUpdate() const {
+            return buildInfo.info.mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+        };
+
+        // topology changed, so rebuilt (and indirect ranges re-seeded)
+        virtual void markDirty() {
+            this->dirty = true;
+            this->pendingSeed = true;
+            this->staticFrames = 0u;
+        };
+
+        // indirect ranges rewritten from geometry table by next upload, discarding counts written by compute (without rebuild of topology)
+        virtual void reseedRanges() {
+            this->pendingSeed = true;
+        };
+
+        // when built by batch of renderer
+        virtual void markBuilt() {
+            this->dirty = false;
+            this->verticesChanged = false;
+            this->built = true;
+            this->prepared = false;
+        };
+
+        //
+        virtual BuildInfo& getBuildInfo() {
+            return buildInfo;
+        };
+
+        //
+        // of pending build, same before and after prepareBuild
+        virtual VkDeviceSize getScratchSize() const {
+            return (prepared ? this->isUpdate() : this->shouldRefit()) ? updateScratchSize : scratchSize;
+        };
+
+        // shared scratch, used by batched build
+        virtual void setScratchData(VkDeviceAddress address) {
+            buildInfo.info.scratchData.deviceAddress = address;
+        };
+
+        // scratch of single build, from shared arena or own (created on demand)
+        virtual void acquireScratchCommand(VkCommandBuffer commandBuffer) 
+        {
+            if (info.scratchArena.has()) {
+                info.scratchArena->cmdReuseBarrier(commandBuffer);
+                this->setScratchData(info.scratchArena->acquire(this->getScratchSize()));
+                return;
+            };
+            if (accScratch.range() < scratchSize) {
+                if (accScratch.range() > 0ull) { this->retiredScratch.push_back(Retired<vkf::VectorBase>{ accScratch, recordingFrame }); };
+                this->accScratch = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = scratchSize});
+            };
+            this->setScratchData(accScratch.deviceAddress());
+        };
+
+        // own scratch, kept until recorded build is completed (recreated by next build)
+        virtual void retireScratch() 
+        {
+            if (accScratch.range() > 0ull) { this->retiredScratch.push_back(Retired<vkf::VectorBase>{ accScratch, recordingFrame }); };
+            this->accScratch = vkf::VectorBase{};
+        };
+
+        // own scratch and retired since first, when blocking build is completed (earlier are released by releaseRetired)
+        virtual void releaseScratch(uintptr_t first = 0ull) 
+        {
+            this->accScratch = vkf::VectorBase{};
+            this->retiredScratch.resize(std::min(first, uintptr_t(retiredScratch.size())));
+        };
+
+        // geometry table, before build
+        virtual void uploadCommand(VkCommandBuffer commandBuffer) 
+        {   
+            if (this->isAccelerationStale()) { this->makeAccelerationStructure(); };
+            this->uploadTablesCommand(commandBuffer);
+        };
+
+        // geometry table and seed of indirect ranges only (acceleration structure is not touched)
+        virtual void uploadTablesCommand(VkCommandBuffer commandBuffer) 
         {   
-            if (!acceleration) { this->makeAccelerationStructure(); };
             {   // TODO: indirect condition
                 geometries->copyFromVector(info.geometries);
                 geometries->cmdCopyFromCpu(commandBuffer);
             };
+
+            // seed only when topology changed or reseedRanges, otherwise ranges of compute are kept
+            if (info.indirectBuild && pendingSeed) {
+                this->pendingSeed = false;
+                this->fillRanges();
+                std::vector<VkAccelerationStructureBuildRangeInfoKHR> seed(buildInfo.ranges.size());
+                memcpy(seed.data(), buildInfo.ranges.data(), seed.size() * sizeof(VkAccelerationStructureBuildRangeInfoKHR));
+                indirectRanges->markDirty(0ull, seed.size());
+                indirectRanges->copyFromVector(seed);
+                indirectRanges->cmdCopyFromCpu(commandBuffer);
+            };
+        };
+
+        // 
+        virtual void fillRanges() 
+        {
             buildInfo.ranges.resize(info.geometries.size());
             for (uint32_t i=0;i<buildInfo.builds.size();i++) 
             {   // 
                 buildInfo.ranges[i].firstVertex = info.geometries[i].index.first;
-                buildInfo.ranges[i].primitiveCount = info.geometries[i].primitive.count;
+                buildInfo.ranges[i].primitiveCount = this->getBuildPrimitiveCount(info.geometries[i]);
                 buildInfo.ranges[i].primitiveOffset = info.geometries[i].primitive.offset;
                 buildInfo.ranges[i].transformOffset = sizeof(GeometryInfo) * i;
             };
+        };
 
-            const auto ptr = &buildInfo.ranges[0u];
-            device->dispatch->CmdBuildAccelerationStructuresKHR(commandBuffer, 1u, buildInfo.info, &ptr);
+        // refit in place, when topology and geometry table are same
+        virtual bool shouldRefit() const 
+        {
+            return info.policy.allowUpdate && built && !dirty && verticesChanged && !this->isAccelerationStale() && (info.policy.rebuildThreshold == 0u || refitCount < info.policy.rebuildThreshold);
         };
 
         // 
-        virtual void makeAccelerationStructure() 
+        virtual void prepareBuild() 
+        {
+            const bool refit = this->shouldRefit();
+            this->prepared = true;
+            this->fillBuildInfo();
+            if (refit) {
+                buildInfo.info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+                buildInfo.info.srcAccelerationStructure = this->acceleration;
+                this->refitCount++;
+            } else {
+                buildInfo.info.srcAccelerationStructure = VK_NULL_HANDLE;
+                this->refitCount = 0u;
+            };
+
+            // 
+            this->fillRanges();
+        };
+
+        //
+        virtual bool isIndirectBuild() const {
+            return info.indirectBuild;
+        };
+
+        // ranges written on device (counts up to counts used for sizing), after upload and prepare
+        virtual void buildIndirectCommand(VkCommandBuffer commandBuffer) 
+        {
+            VkMemoryBarrier memoryBarrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+            };
+            device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+
+            // 
+            const VkDeviceAddress address = indirectRanges->getDeviceBuffer().deviceAddress();
+            const uint32_t stride = sizeof(VkAccelerationStructureBuildRangeInfoKHR);
+            const uint32_t* maxCounts = maxPrimitiveCounts.data();
+            device->dispatch->CmdBuildAccelerationStructuresIndirectKHR(commandBuffer, 1u, buildInfo.info, &address, &stride, &maxCounts);
+        };
+
+        // 
+        virtual void buildCommand(VkCommandBuffer commandBuffer) 
+        {   
+            this->uploadCommand(commandBuffer);
+            this->prepareBuild();
+            this->acquireScratchCommand(commandBuffer);
+
+            if (info.indirectBuild) {
+                this->buildIndirectCommand(commandBuffer);
+            } else {
+                const auto ptr = &buildInfo.ranges[0u];
+                device->dispatch->CmdBuildAccelerationStructuresKHR(commandBuffer, 1u, buildInfo.info, &ptr);
+            };
+            this->markBuilt();
+
+            // static geometry is built once, so own scratch is not kept
+            if (!info.policy.allowUpdate) { this->retireScratch(); };
+
+            // 
+            if (this->allowsCompaction()) {
+                VkMemoryBarrier memoryBarrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .pNext = nullptr,
+                    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+                };
+                device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+                this->queryCompactedSizeCommand(commandBuffer);
+            };
+        };
+
+        // after build and barrier, result read by next compaction command
+        virtual void queryCompactedSizeCommand(VkCommandBuffer commandBuffer) 
+        {
+            if (!this->allowsCompaction() || compacted) { return; };
+            if (!compactionQuery) {
+                VkQueryPoolCreateInfo queryPoolInfo = {
+                    .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                    .pNext = nullptr,
+                    .flags = 0u,
+                    .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                    .queryCount = 1u,
+                    .pipelineStatistics = 0u
+                };
+                vkt::handleVk(device->dispatch->CreateQueryPool(&queryPoolInfo, nullptr, &compactionQuery));
+            };
+            device->dispatch->CmdResetQueryPool(commandBuffer, compactionQuery, 0u, 1u);
+            device->dispatch->CmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, 1u, &acceleration, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, compactionQuery, 0u);
+            this->compactionPending = true;
+        };
+
+        //
+        virtual bool isCompactionPending() const {
+            return compactionPending;
+        };
+
+        // copy into right-sized storage, false when query result not ready (original retired)
+        virtual bool compactCommand(VkCommandBuffer commandBuffer) 
+        {
+            if (!compactionPending) { return false; };
+
+            VkDeviceSize compactedSize = 0ull;
+            if (device->dispatch->GetQueryPoolResults(compactionQuery, 0u, 1u, sizeof(VkDeviceSize), &compactedSize, sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) { return false; };
+            this->compactionPending = false;
+            if (compactedSize <= 0ull || compactedSize >= accStorage.range()) { return false; };
+
+            // 
+            const VkAccelerationStructureKHR original = this->acceleration;
+            this->retireAcceleration();
+
+            // 
+            this->accStorage = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = compactedSize});
+            {   // create acceleration structure
+                vkh::VkAccelerationStructureCreateInfoKHR accelerationInfo = {};
+                accelerationInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+                accelerationInfo = this->accStorage;
+                device->dispatch->CreateAccelerationStructureKHR(accelerationInfo, nullptr, &this->acceleration);
+            };
+
+            // 
+            VkCopyAccelerationStructureInfoKHR copyInfo = {
+                .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+                .pNext = nullptr,
+                .src = original,
+                .dst = acceleration,
+                .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR
+            };
+            device->dispatch->CmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+
+            // address changed, instances should re-accept
+            buildInfo.info.dstAccelerationStructure = this->acceleration;
+            this->compacted = true;
+            this->generation++;
+            return true;
+        };
+
+        //
+        virtual VkAccelerationStructureKHR getAccelerationStructure() const {
+            return acceleration;
+        };
+
+        //
+        virtual uint64_t getContentHash() const {
+            return info.contentHash;
+        };
+
+        // description of level for cache key (without device addresses, which changes between runs)
+        virtual uint64_t getDescriptorHash() 
+        {
+            const auto& bindings = info.registry->getInfo().bindings;
+            uint64_t hash = hashCombine(hashBytes(nullptr, 0u), uint32_t(this->getBuildFlags(info.policy, promoted)));
+            for (auto& geometry : info.geometries) {
+                hash = hashCombine(hash, geometry.transform);
+                hash = hashCombine(hash, glm::uvec4(geometry.isOpaque, geometry.useHalf, geometry.type, uint32_t(geometry.index.type)));
+                hash = hashCombine(hash, glm::ivec4(geometry.index.first, geometry.index.max, geometry.primitive.offset, geometry.primitive.count));
+
+                // vertices of triangles, boxes of custom geometry
+                const uint32_t source = geometry.type == 0u ? geometry.vertex : geometry.aabbs;
+                if (source < bindings.size()) {
+                    hash = hashCombine(hash, glm::uvec2(bindings[source].format & BindingFormatMask, bindings[source].stride));
+                };
+            };
+            return hash;
+        };
+
+        // for sharing between levels, referenced data by address or by application content hash (with materials and attributes, which aren't part of structure)
+        virtual uint64_t getGeometryHash() 
+        {
+            const auto& bindings = info.registry->getInfo().bindings;
+            uint64_t hash = this->getDescriptorHash();
+            for (auto& geometry : info.geometries) {
+                hash = hashCombine(hash, glm::uvec4(geometry.primitive.materials, geometry.aabbs, geometry.vertex, 0u));
+                hash = hashCombine(hash, glm::ivec4(geometry.attributes.texcoords, geometry.attributes.normals, geometry.attributes.tangents, geometry.attributes.colors));
+            };
+            if (info.contentHash) { return hashCombine(hash, info.contentHash); };
+            for (auto& geometry : info.geometries) {
+                const uint32_t source = geometry.type == 0u ? geometry.vertex : geometry.aabbs;
+                hash = hashCombine(hash, geometry.index.ptr.data);
+                hash = hashCombine(hash, source < bindings.size() ? bindings[source].ptr.data : 0ull);
+            };
+            return hash;
+        };
+
+        // field-wise, after equal geometry hash (pointers are not compared when content hash is same)
+        virtual bool isSameGeometry(vkh::uni_ptr<GeometryLevel> other) const 
+        {
+            const auto& otherInfo = other->getInfo();
+            if (info.registry.has() != otherInfo.registry.has() || (info.registry.has() && &info.registry->getInfo() != &otherInfo.registry->getInfo())) { return false; };
+            if (info.contentHash != otherInfo.contentHash || info.geometries.size() != otherInfo.geometries.size()) { return false; };
+            if (info.indirectBuild != otherInfo.indirectBuild || memcmp(&info.policy, &otherInfo.policy, sizeof(BuildPolicy)) != 0) { return false; };
+            for (uintptr_t i = 0; i < info.geometries.size(); i++) {
+                const auto& a = info.geometries[i];
+                const auto& b = otherInfo.geometries[i];
+                if (a.transform != b.transform || a.isOpaque != b.isOpaque || a.useHalf != b.useHalf || a.hasTransform != b.hasTransform || a.type != b.type) { return false; };
+                if (a.hasTexcoords != b.hasTexcoords || a.hasNormals != b.hasNormals || a.hasTangents != b.hasTangents || a.hasColors != b.hasColors) { return false; };
+                if (a.aabbs != b.aabbs || a.vertex != b.vertex || a.primitive.offset != b.primitive.offset || a.primitive.count != b.primitive.count || a.primitive.materials != b.primitive.materials) { return false; };
+                if (a.index.first != b.index.first || a.index.max != b.index.max || a.index.type != b.index.type) { return false; };
+                if (memcmp(&a.attributes, &b.attributes, sizeof(Attributes)) != 0) { return false; };
+                if (!info.contentHash && a.index.ptr.data != b.index.ptr.data) { return false; };
+            };
+            return true;
+        };
+
+        // into device memory, which size is got by serialization size query
+        virtual void serializeCommand(VkCommandBuffer commandBuffer, VkDeviceAddress data) 
+        {
+            VkCopyAccelerationStructureToMemoryInfoKHR copyInfo = {
+                .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR,
+                .pNext = nullptr,
+                .src = acceleration,
+                .dst = { .deviceAddress = data },
+                .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR
+            };
+            device->dispatch->CmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyInfo);
+        };
+
+        // instead of build, from compatible serialized data (unused storage retired)
+        virtual void deserializeCommand(VkCommandBuffer commandBuffer, VkDeviceAddress data, VkDeviceSize deserializedSize) 
+        {
+            // sizes for later refits, but without making structure which would be replaced
+            this->promoted = info.policy.quality == BuildQuality::Auto && staticFrames >= info.policy.promoteAfterFrames;
+            this->promotePending = false;
+            this->fillBuildInfo();
+            this->querySizes();
+            this->pendingSeed = true;
+            this->uploadTablesCommand(commandBuffer);
+
+            // 
+            this->retireAcceleration();
+            this->accStorage = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = deserializedSize});
+            {   // create acceleration structure
+                vkh::VkAccelerationStructureCreateInfoKHR accelerationInfo = {};
+                accelerationInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+                accelerationInfo = this->accStorage;
+                device->dispatch->CreateAccelerationStructureKHR(accelerationInfo, nullptr, &this->acceleration);
+            };
+
+            // 
+            VkCopyMemoryToAccelerationStructureInfoKHR copyInfo = {
+                .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR,
+                .pNext = nullptr,
+                .src = { .deviceAddress = data },
+                .dst = acceleration,
+                .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR
+            };
+            device->dispatch->CmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+
+            // usually compacted, so rebuild needs re-make
+            buildInfo.info.dstAccelerationStructure = this->acceleration;
+            this->builtGeneration = geometries->getGeneration();
+            this->compacted = true;
+            this->compactionPending = false;
+            this->markBuilt();
+            this->generation++;
+        };
+
+        // current handle and storage, kept until frame which retired them is completed
+        virtual void retireAcceleration() 
+        {
+            if (acceleration || accStorage.range() > 0ull) { this->retiredAccelerations.push_back(Retired<AccelerationStorage>{ AccelerationStorage{ acceleration, accStorage }, recordingFrame }); };
+            this->acceleration = VK_NULL_HANDLE;
+            this->accStorage = vkf::VectorBase{};
+        };
+
+        // retired by frames up to completed one (e.g. after wait of oldest frame in flight)
+        virtual void releaseRetired(uint64_t completedFrame) 
+        {
+            releaseCompleted(retiredAccelerations, completedFrame, [this](AccelerationStorage& retired) { if (retired.handle) { device->dispatch->DestroyAccelerationStructureKHR(retired.handle, nullptr); }; });
+            releaseCompleted(retiredScratch, completedFrame, [](vkf::VectorBase&) {});
+            releaseCompleted(retiredIndexBuffers, completedFrame, [this](vkf::VectorBase& retired) { this->releaseBuffer(retired); });
+            geometries->releaseRetired(completedFrame);
+            indirectRanges->releaseRetired(completedFrame);
+        };
+
+        //
+        virtual void setRecordingFrame(uint64_t frame) override 
+        {
+            this->recordingFrame = frame;
+            geometries->setRecordingFrame(frame);
+            indirectRanges->setRecordingFrame(frame);
+        };
+
+        // single retired structure, when blocking submit which replaced it is completed (others are kept for their frames)
+        virtual void releaseRetiredAcceleration(VkAccelerationStructureKHR handle) 
+        {
+            if (!handle) { return; };
+            std::vector<Retired<AccelerationStorage>> pending = {};
+            for (auto& retired : retiredAccelerations) {
+                if (retired.value.handle == handle) { device->dispatch->DestroyAccelerationStructureKHR(handle, nullptr); } else { pending.push_back(retired); };
+            };
+            this->retiredAccelerations = pending;
+        };
+
+        // blocking variant, original is released after copy
+        virtual bool compact(vkh::uni_ptr<vkf::Queue> queue = {}) 
+        {
+            bool result = false;
+            const VkAccelerationStructureKHR original = this->acceleration;
+            queue->submitOnce([&,this](VkCommandBuffer commandBuffer) 
+            {   // 
+                result = this->compactCommand(commandBuffer);
+            });
+            if (result) { this->releaseRetiredAcceleration(original); };
+            return result;
+        };
+
+        // by binding format, undefined when not position (octahedral, 8-bit and packed formats are rejected)
+        virtual VkFormat getVertexFormat(const GeometryInfo& geometry, const BindingInfo& vertex) const 
+        {
+            const BindingFormat format = BindingFormat(vertex.format & BindingFormatMask);
+            if (geometry.useHalf || format == BindingFormat::Half4) { return VK_FORMAT_R16G16B16A16_SFLOAT; };
+            if (format == BindingFormat::Snorm16x4) { return VK_FORMAT_R16G16B16A16_SNORM; };
+            if (format == BindingFormat::Float4) { return VK_FORMAT_R32G32B32_SFLOAT; };
+            return VK_FORMAT_UNDEFINED;
+        };
+
+        // triangles with rejected vertex format are built empty
+        virtual uint32_t getBuildPrimitiveCount(const GeometryInfo& geometry) const 
+        {
+            if (geometry.type != 0u || !info.registry.has() || info.registry->getInfo().bindings.size() <= geometry.vertex) { return geometry.primitive.count; };
+            return this->getVertexFormat(geometry, info.registry->getInfo().bindings[geometry.vertex]) != VK_FORMAT_UNDEFINED ? geometry.primitive.count : 0u;
+        };
+
+        // 
+        virtual void validateGeometry(GeometryInfo& geometry) const 
+        {
+            if (this->getBuildPrimitiveCount(geometry) != geometry.primitive.count) {
+                std::cerr << "Vertex binding format is not suitable for positions, geometry rejected" << std::endl;
+                geometry.primitive.count = 0u;
+            };
+        };
+
+        // geometries, flags and mode (without storage)
+        virtual void fillBuildInfo() 
         {
             auto accelerationStructureType = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
 
@@ -201,17 +728,18 @@ namespace icv {
                 {
                     // fill ranges
                     buildInfo.ranges[i].firstVertex = info.geometries[i].index.first;
-                    buildInfo.ranges[i].primitiveCount = info.geometries[i].primitive.count;
+                    buildInfo.ranges[i].primitiveCount = this->getBuildPrimitiveCount(info.geometries[i]);
                     buildInfo.ranges[i].primitiveOffset = info.geometries[i].primitive.offset;
                     buildInfo.ranges[i].transformOffset = sizeof(GeometryInfo) * i;
 
                     // fill build info
                     if (info.geometries[i].type == 0u) {
                         auto& vertex = info.registry->getInfo().bindings[info.geometries[i].vertex];
+                        const VkFormat vertexFormat = this->getVertexFormat(info.geometries[i], vertex);
                         buildInfo.builds[i].geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
                         buildInfo.builds[i].geometry = vkh::VkAccelerationStructureGeometryTrianglesDataKHR
                         {
-                            .vertexFormat = info.geometries[i].useHalf ? VK_FORMAT_R16G16B16_SFLOAT : VK_FORMAT_R32G32B32_SFLOAT,
+                            .vertexFormat = vertexFormat != VK_FORMAT_UNDEFINED ? vertexFormat : VK_FORMAT_R32G32B32_SFLOAT, // rejected are empty
                             .vertexData = vertex.ptr.data /*bufferDeviceAddress(info.registry->getInfo().buffers[vertex.ptr.bufferId]) + vertex.ptr.offset*/,
                             .vertexStride = vertex.stride,
                             .maxVertex = info.geometries[i].index.max,
@@ -238,27 +766,43 @@ namespace icv {
                     };
                 };
                 buildInfo.info.type = accelerationStructureType;
-                buildInfo.info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR;
+                buildInfo.info.flags = this->getBuildFlags(info.policy, promoted);
                 buildInfo.info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
                 buildInfo.info.geometryCount = buildInfo.builds.size();
                 buildInfo.info.pGeometries = &buildInfo.builds[0u];
             };
+        };
 
+        // storage and scratch sizes, by max primitive counts of filled build info
+        virtual vkh::VkAccelerationStructureBuildSizesInfoKHR querySizes() 
+        {
             vkh::VkAccelerationStructureBuildSizesInfoKHR sizes = {};
-            {   // 
-                std::vector<uint32_t> primitiveCount = {};
-                for (uint32_t i=0;i<buildInfo.builds.size();i++) 
-                {
-                    primitiveCount.push_back(info.geometries[i].primitive.count);
-                };
-
-                // 
-                device->dispatch->GetAccelerationStructureBuildSizesKHR(VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo.info, primitiveCount.data(), &sizes);
+            std::vector<uint32_t> primitiveCount = {};
+            for (uint32_t i=0;i<buildInfo.builds.size();i++) 
+            {
+                primitiveCount.push_back(this->getBuildPrimitiveCount(info.geometries[i]));
             };
+            this->maxPrimitiveCounts = primitiveCount;
 
-            {   // 
+            // 
+            device->dispatch->GetAccelerationStructureBuildSizesKHR(VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo.info, primitiveCount.data(), &sizes);
+            this->scratchSize = sizes.buildScratchSize;
+            this->updateScratchSize = sizes.updateScratchSize;
+            return sizes;
+        };
+
+        // 
+        virtual void makeAccelerationStructure() 
+        {
+            auto accelerationStructureType = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+            this->promoted = info.policy.quality == BuildQuality::Auto && staticFrames >= info.policy.promoteAfterFrames;
+            this->promotePending = false;
+            this->fillBuildInfo();
+            const vkh::VkAccelerationStructureBuildSizesInfoKHR sizes = this->querySizes();
+
+            {   // previous is referenced by top level and frames in flight
+                this->retireAcceleration();
                 this->accStorage = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = sizes.accelerationStructureSize});
-                this->accScratch = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = sizes.buildScratchSize});
             };
 
             {   // create acceleration structure
@@ -270,30 +814,171 @@ namespace icv {
 
             {   //
                 buildInfo.info.dstAccelerationStructure = this->acceleration;
-                buildInfo.info.scratchData = this->accScratch;
             };
+
+            // 
+            this->builtGeneration = geometries->getGeneration();
+            this->compactionPending = false;
+            this->compacted = false;
+            this->built = false;
+            this->pendingSeed = true;
+            this->generation++;
         };
 
         //
         uintptr_t pushGeometry(vkh::uni_arg<GeometryInfo> geometryInfo) {
             uintptr_t last = info.geometries.size();
             info.geometries.push_back(geometryInfo);
+            this->validateGeometry(info.geometries.back());
+            geometries->markDirty(last);
+            this->markDirty();
             return last;
         };
 
-        //
+        // index pointers into geometry arena, after relocation by registry (moved geometries re-uploaded and rebuilt)
+        virtual bool remapAddresses() 
+        {
+            if (!info.registry.has() || remappedGeneration == info.registry->getRelocationGeneration()) { return false; };
+            const uint64_t sinceGeneration = this->remappedGeneration;
+            this->remappedGeneration = info.registry->getRelocationGeneration();
+
+            //
+            bool changed = false;
+            for (uintptr_t i = 0; i < info.geometries.size(); i++) {
+                auto& index = info.geometries[i].index;
+                if (!index.ptr.data) { continue; };
+                const VkDeviceAddress address = info.registry->remapAddress(index.ptr.data, sinceGeneration);
+                if (address == index.ptr.data) { continue; };
+                index.ptr.data = address;
+                geometries->markDirty(i);
+                changed = true;
+            };
+            if (changed) { this->markDirty(); };
+            return changed;
+        };
+
+        // binding indices, after every GeometryRegistry::compactBindings since last remap (called by renderer before builds)
+        virtual bool remapBindings() 
+        {
+            if (!info.registry.has() || remappedBindingGeneration == info.registry->getCompactionGeneration()) { return false; };
+            const uint64_t sinceGeneration = this->remappedBindingGeneration;
+            this->remappedBindingGeneration = info.registry->getCompactionGeneration();
+            return this->remapBindings([&](intptr_t index) { return info.registry->remapBinding(index, sinceGeneration); });
+        };
+
+        // binding indices, by single remap of GeometryRegistry::compactBindings (removed are kept as is)
+        virtual bool remapBindings(const std::vector<intptr_t>& remap) 
+        {
+            return this->remapBindings([&](intptr_t index) { return (index < 0 || uintptr_t(index) >= remap.size() || remap[index] < 0) ? index : remap[index]; });
+        };
+
+        // 
+        virtual bool remapBindings(const std::function<intptr_t(intptr_t)>& remap) 
+        {
+            auto remapped = [&](auto& binding) {
+                const intptr_t index = intptr_t(binding);
+                const intptr_t moved = remap(index);
+                if (moved == index) { return false; };
+                binding = std::remove_reference_t<decltype(binding)>(moved); return true;
+            };
+
+            //
+            bool changed = false;
+            for (uintptr_t i = 0; i < info.geometries.size(); i++) {
+                auto& geometry = info.geometries[i];
+                bool moved = false;
+                moved |= remapped(geometry.vertex);
+                moved |= remapped(geometry.aabbs);
+                moved |= remapped(geometry.primitive.materials);
+                moved |= remapped(geometry.attributes.texcoords);
+                moved |= remapped(geometry.attributes.normals);
+                moved |= remapped(geometry.attributes.tangents);
+                moved |= remapped(geometry.attributes.colors);
+                if (moved) { geometries->markDirty(i); changed = true; };
+            };
+            return changed;
+        };
+
+        // narrowest type, which is legal for acceleration structure build (8-bit is not, even with VK_EXT_index_type_uint8)
+        virtual IndexType getNarrowIndexType(uint32_t max) const {
+            return (info.narrowIndices && max <= 0xFFFFu) ? IndexType::Uint16 : IndexType::Uint32;
+        };
+
+        // from 32-bit indices, repacked into own buffer and uploaded with batch (readIndex picks type from geometry)
+        virtual uintptr_t pushGeometry(vkh::uni_arg<GeometryInfo> geometryInfo, const std::vector<uint32_t>& indices, vkh::uni_ptr<TransferBatch> batch) 
+        {
+            GeometryInfo geometry = geometryInfo;
+
+            // from indices themselves, also used as max vertex of build
+            const uint32_t maxIndex = indices.size() > 0ull ? *std::max_element(indices.begin(), indices.end()) : 0u;
+            geometry.index.max = maxIndex;
+            geometry.index.type = this->getNarrowIndexType(maxIndex);
+
+            //
+            const uintptr_t index = info.geometries.size();
+            if (geometry.index.type == IndexType::Uint16) {
+                std::vector<uint16_t> narrow(indices.size());
+                for (uintptr_t i = 0; i < indices.size(); i++) { narrow[i] = uint16_t(indices[i]); };
+                geometry.index.ptr.data = this->pushIndexBuffer(index, narrow.data(), narrow.size() * sizeof(uint16_t), batch);
+            } else {
+                geometry.index.ptr.data = this->pushIndexBuffer(index, indices.data(), indices.size() * sizeof(uint32_t), batch);
+            };
+            return this->pushGeometry(geometry);
+        };
+
+        // own buffer of geometry, previous one retired
+        virtual VkDeviceAddress pushIndexBuffer(uintptr_t geometryIndex, const void* data, VkDeviceSize size, vkh::uni_ptr<TransferBatch> batch) 
+        {
+            this->retireIndexBuffer(geometryIndex);
+            if (indexBuffers.size() <= geometryIndex) { this->indexBuffers.resize(geometryIndex + 1u); };
+            auto& buffer = this->indexBuffers[geometryIndex] = createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, .size = std::max(size, VkDeviceSize(4u)), .pooled = true });
+            batch->pushUpload(buffer, data, size);
+            return buffer.deviceAddress();
+        };
+
+        // may be still read by builds and draws of frames in flight (returned by releaseRetired)
+        virtual void retireIndexBuffer(uintptr_t geometryIndex) 
+        {
+            if (indexBuffers.size() <= geometryIndex || indexBuffers[geometryIndex].range() <= 0ull) { return; };
+            this->retiredIndexBuffers.push_back(Retired<vkf::VectorBase>{ indexBuffers[geometryIndex], recordingFrame });
+            this->indexBuffers[geometryIndex] = vkf::VectorBase{};
+        };
+
+        // own index buffer is retired, when replaced geometry doesn't point into it
         void setGeometry(uintptr_t index, vkh::uni_arg<GeometryInfo> geometryInfo) {
+            if (index < indexBuffers.size() && indexBuffers[index].range() > 0ull && indexBuffers[index].deviceAddress() != geometryInfo->index.ptr.data) { this->retireIndexBuffer(index); };
             if (info.geometries.size() <= index) { info.geometries.resize(index+1u); };
             info.geometries[index] = geometryInfo;
+            this->validateGeometry(info.geometries[index]);
+            geometries->markDirty(index);
+            this->markDirty();
+        };
+
+        // geometry table only, build still needs own command
+        virtual void enqueueUpload(vkh::uni_ptr<TransferBatch> batch)
+        {   // 
+            geometries->copyFromVector(info.geometries);
+            batch->pushDataSet(geometries);
+        };
+
+        //
+        virtual void selectStaging(uint32_t frameIndex)
+        {   // 
+            geometries->selectStaging(frameIndex);
+            indirectRanges->selectStaging(frameIndex);
         };
 
         // 
         virtual void flush(vkh::uni_ptr<vkf::Queue> queue = {}) 
         {   // 
+            const uintptr_t retiredCount = retiredScratch.size();
             queue->submitOnce([&,this](VkCommandBuffer commandBuffer) 
             {   // 
                 this->buildCommand(commandBuffer);
             });
+
+            // static geometry is built once
+            if (!info.policy.allowUpdate) { this->releaseScratch(retiredCount); };
         };
     };
 
@@ -2,10 +2,28 @@
 
 // 
 #include "./core.hpp"
+#include "./dataSet.hpp"
+#include "./transferBatch.hpp"
+#include <unordered_map>
+#include <glm/gtc/packing.hpp>
 
 // 
 namespace icv {
 
+    // decoded by readBinding4, same values in geometryRegistry.glsl
+    enum class BindingFormat : uint32_t {
+        Float4 = 0u,
+        Half4 = 1u,
+        Snorm16x4 = 2u,
+        Unorm8x4 = 3u,
+        Octahedral = 4u, // unit normals, as snorm16x2 (w is zero)
+        Unorm10x3A2 = 5u
+    };
+
+    // set by registry, when pointer and stride allow wide loads of format
+    constexpr uint32_t BindingAlignedBit = 0x10000u;
+    constexpr uint32_t BindingFormatMask = 0xFFFFu;
+
 #pragma pack(push, 8)
     //
     struct RawData
@@ -18,7 +36,7 @@ namespace icv {
     // 
     struct BindingInfo 
     {
-        uint32_t format = 0u; // reserved
+        uint32_t format = 0u; // BindingFormat, with aligned bit
         uint32_t stride = 16u;
         RawData ptr = {};
     };
@@ -31,8 +49,19 @@ namespace icv {
         std::vector<vkh::VkDescriptorBufferInfo> buffers = {};
         //std::vector<vkt::VectorBase> buffers = {};
 
-        uint32_t maxBindingCount = 128u;
-        
+        uint32_t maxBindingCount = 128u; // initial capacity, grows when exceeded
+        VkDeviceSize arenaSize = 64ull * 1024ull * 1024ull; // initial capacity of geometry arena, grows when exceeded
+        VkDeviceSize streamAlignment = 16ull; // covers aligned loads of every binding format
+        bool deduplicateBindings = false; // identical bindings pushed once, shared by same index (opt-in, setBinding of shared slot copies it)
+        uint32_t stagingCount = 1u;
+        DataSetMemory memory = DataSetMemory::Auto;
+    };
+
+    // suballocated from geometry arena (binding is -1 for index streams)
+    struct GeometryStream 
+    {
+        VkDeviceSize size = 0ull;
+        intptr_t binding = -1;
     };
 
     // 
@@ -45,6 +74,99 @@ namespace icv {
         VkDescriptorSet set = VK_NULL_HANDLE;
         bool created = false;
 
+        // for rewrite, when binding buffer grown
+        DescriptorInfo descriptorInfo = {};
+        uint64_t descriptorGeneration = 0ull;
+
+        // identical bindings (when enabled, or same content by application hash) share one entry
+        std::unordered_map<uint64_t, uintptr_t> bindingIndices = {};
+        std::unordered_map<uint64_t, uintptr_t> contentIndices = {};
+
+        // vertex, attribute and index streams in one buffer, by offset (previous retained by batch of relocation copy)
+        vkf::VectorBase arena = {};
+        VkDeviceSize arenaCapacity = 0ull;
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges = {}; // offset, size
+        std::map<VkDeviceSize, GeometryStream> streams = {};
+        std::vector<std::unordered_map<VkDeviceAddress, VkDeviceAddress>> relocations = {}; // by every relocation (generation), for index pointers of levels
+        uint64_t relocationGeneration = 0ull;
+
+        // removed slots reused by next bindings, generation bumped by every removal (stale identifiers)
+        std::vector<uintptr_t> freeBindings = {};
+        std::vector<uint32_t> bindingGenerations = {};
+        std::vector<uint32_t> bindingReferences = {}; // by every push, which returned slot (deduplicated share it)
+
+        // pooled buffers of encoded bindings, by slot (retired with removal of slot, or when pointer replaced)
+        std::vector<vkf::VectorBase> encodedBuffers = {};
+        std::vector<Retired<vkf::VectorBase>> retiredEncodedBuffers = {};
+
+        // old to new index, by every compaction (generation), for binding indices of levels
+        std::vector<std::vector<intptr_t>> bindingRemaps = {};
+
+        //
+        virtual uintptr_t allocateBindingSlot() 
+        {
+            this->bindingGenerations.resize(std::max(bindingGenerations.size(), info.bindings.size()));
+            this->bindingReferences.resize(std::max(bindingReferences.size(), info.bindings.size()));
+            if (freeBindings.size() > 0ull) {
+                const uintptr_t index = freeBindings.back();
+                this->freeBindings.pop_back();
+                this->bindingReferences[index] = 1u;
+                return index;
+            };
+            const uintptr_t index = info.bindings.size();
+            this->info.bindings.push_back(BindingInfo{});
+            this->bindingGenerations.resize(std::max(bindingGenerations.size(), info.bindings.size()));
+            this->bindingReferences.resize(std::max(bindingReferences.size(), info.bindings.size()));
+            this->bindingReferences[index] = 1u;
+            return index;
+        };
+
+        // may be still read by frames in flight (returned by releaseRetired)
+        virtual void retireEncodedBuffer(uintptr_t index) 
+        {
+            if (encodedBuffers.size() <= index || encodedBuffers[index].range() <= 0ull) { return; };
+            this->retiredEncodedBuffers.push_back(Retired<vkf::VectorBase>{ encodedBuffers[index], recordingFrame });
+            this->encodedBuffers[index] = vkf::VectorBase{};
+        };
+
+        // deduplicated push, slot shared with previous owners
+        virtual uintptr_t shareBinding(uintptr_t index) 
+        {
+            this->bindingReferences.resize(std::max(bindingReferences.size(), info.bindings.size()));
+            this->bindingReferences[index]++;
+            return index;
+        };
+
+        // dedup entries, which are pointing to slot
+        virtual void forgetBinding(uintptr_t index) 
+        {
+            for (auto it = bindingIndices.begin(); it != bindingIndices.end();) { if (it->second == index) { it = bindingIndices.erase(it); } else { it++; }; };
+            for (auto it = contentIndices.begin(); it != contentIndices.end();) { if (it->second == index) { it = contentIndices.erase(it); } else { it++; }; };
+        };
+
+        //
+        virtual VkDeviceSize alignStream(VkDeviceSize size) const {
+            return std::max(((size + info.streamAlignment - 1ull) / info.streamAlignment) * info.streamAlignment, info.streamAlignment);
+        };
+
+        // first fit, otherwise arena relocated into larger one
+        virtual VkDeviceSize allocateStream(VkDeviceSize size, vkh::uni_ptr<TransferBatch> batch) 
+        {
+            size = this->alignStream(size);
+            for (auto it = freeRanges.begin(); it != freeRanges.end(); it++) {
+                if (it->second < size) { continue; };
+                const VkDeviceSize offset = it->first;
+                const VkDeviceSize rest = it->second - size;
+                this->freeRanges.erase(it);
+                if (rest > 0ull) { this->freeRanges[offset + size] = rest; };
+                return offset;
+            };
+
+            //
+            this->relocateStreams(batch, std::max(std::max(arenaCapacity * VkDeviceSize(2u), info.arenaSize), this->getUsedSize() + size));
+            return this->allocateStream(size, batch);
+        };
+
         // 
         virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<GeometryRegistryInfo> info = GeometryRegistryInfo{}) 
         {
@@ -52,7 +174,9 @@ namespace icv {
             this->device = device;
             this->bindings = std::make_shared<DataSet<BindingInfo>>(device, DataSetInfo{
                 .count = info->maxBindingCount,
-                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                .stagingCount = info->stagingCount,
+                .memory = info->memory
             });
         };
         
@@ -60,6 +184,24 @@ namespace icv {
         GeometryRegistry() {};
         GeometryRegistry(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<GeometryRegistryInfo> info = GeometryRegistryInfo{}) { this->constructor(device, info); };
 
+        // pooled encoded bindings, when no longer used by device
+        ~GeometryRegistry() {
+            for (auto& buffer : encodedBuffers) { if (buffer.range() > 0ull) { this->releaseBuffer(buffer); }; };
+            for (auto& retired : retiredEncodedBuffers) { this->releaseBuffer(retired.value); };
+        };
+
+        // encoded buffers of completed frames returned into pool
+        virtual void releaseRetired(uint64_t completedFrame) {
+            releaseCompleted(retiredEncodedBuffers, completedFrame, [this](vkf::VectorBase& retired) { this->releaseBuffer(retired); });
+            bindings->releaseRetired(completedFrame);
+        };
+
+        //
+        virtual void setRecordingFrame(uint64_t frame) override {
+            this->recordingFrame = frame;
+            bindings->setRecordingFrame(frame);
+        };
+
         //
         static VkDescriptorSetLayout& createDescriptorSetLayout(vkh::uni_ptr<vkf::Device> device, VkDescriptorSetLayout& descriptorSetLayout) {
             auto pipusage = vkh::VkShaderStageFlags{ .eVertex = 1, .eGeometry = 1, .eFragment = 1, .eCompute = 1, .eRaygen = 1, .eAnyHit = 1, .eClosestHit = 1, .eMiss = 1 };
@@ -67,20 +209,20 @@ namespace icv {
             auto dflags = vkh::VkDescriptorSetLayoutCreateFlags{ .eUpdateAfterBindPool = 1 };
 
             if (!descriptorSetLayout) 
-            {   // create descriptor set layout
-                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{});
+            {   // rewritten when binding buffer grows, while still bound (update after bind)
+                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{ .flags = dflags });
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 0u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     .descriptorCount = 256u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 1u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     .descriptorCount = 1u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 vkt::handleVk(device->dispatch->CreateDescriptorSetLayout(descriptorSetLayoutHelper.format(), nullptr, &descriptorSetLayout));
             };
 
@@ -97,16 +239,11 @@ namespace icv {
             return set;
         };
 
-        //
+        // read only, bindings are changed by setBinding
         virtual const GeometryRegistryInfo& getInfo() const {
             return info;
         };
 
-        //
-        virtual GeometryRegistryInfo& getInfo() {
-            return info;
-        };
-
         //
         virtual const vkf::Vector<BindingInfo>& getBuffer() const {
             return bindings->getDeviceBuffer();
@@ -135,16 +272,39 @@ namespace icv {
                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
             }) = bindings->getDeviceBuffer();
             vkt::AllocateDescriptorSetWithUpdate(device->dispatch, descriptorSetHelper, set, created);
+            this->descriptorInfo = info;
+            this->descriptorGeneration = bindings->getGeneration();
             return set;
         };
 
+        // rewrite descriptor set, when binding buffer was reallocated
+        virtual void republishDescriptorSet() 
+        {   // 
+            if (created && descriptorGeneration != bindings->getGeneration()) { this->makeDescriptorSet(descriptorInfo); };
+        };
+
         //
         virtual void copyCommand(VkCommandBuffer commandBuffer)
         {   // 
             bindings->copyFromVector(info.bindings);
+            this->republishDescriptorSet();
             bindings->cmdCopyFromCpu(commandBuffer);
         };
 
+        // 
+        virtual void enqueueUpload(vkh::uni_ptr<TransferBatch> batch)
+        {   // 
+            bindings->copyFromVector(info.bindings);
+            this->republishDescriptorSet();
+            batch->pushDataSet(bindings);
+        };
+
+        //
+        virtual void selectStaging(uint32_t frameIndex)
+        {   // 
+            bindings->selectStaging(frameIndex);
+        };
+
         // 
         virtual void flush(vkh::uni_ptr<vkf::Queue> queue = {}) 
         {   // 
@@ -164,11 +324,342 @@ namespace icv {
         //
         virtual uintptr_t pushBinding(vkh::uni_arg<BindingInfo> binding) 
         {   
-            uintptr_t index = this->info.bindings.size();
-            this->info.bindings.push_back(binding);
+            BindingInfo value = binding;
+            value.format = this->validateAlignment(value);
+            const uint64_t hash = hashCombine(hashBytes(nullptr, 0u), value);
+            auto found = bindingIndices.find(hash);
+            if (info.deduplicateBindings && found != bindingIndices.end() && found->second < info.bindings.size() && !memcmp(&info.bindings[found->second], &value, sizeof(BindingInfo))) { return this->shareBinding(found->second); };
+
+            //
+            uintptr_t index = this->allocateBindingSlot();
+            this->info.bindings[index] = value;
+            this->bindings->markDirty(index);
+            if (info.deduplicateBindings) { this->bindingIndices[hash] = index; };
+            return index;
+        };
+
+        // same content in other buffer reuses first binding (then that buffer may be released by application), explicit by non-zero hash
+        virtual uintptr_t pushBinding(vkh::uni_arg<BindingInfo> binding, uint64_t contentHash) 
+        {   
+            const uint64_t hash = hashCombine(hashCombine(contentHash, binding->format), binding->stride);
+            auto found = contentIndices.find(hash);
+            if (contentHash && found != contentIndices.end()) { return this->shareBinding(found->second); };
+
+            //
+            uintptr_t index = this->pushBinding(binding);
+            if (contentHash) { this->contentIndices[hash] = index; };
+            return index;
+        };
+
+        // rewrite of existing slot (identifier stays, dedup entries of previous value are dropped), shared slot is copied on write into returned one
+        virtual uintptr_t setBinding(uintptr_t index, vkh::uni_arg<BindingInfo> binding)
+        {
+            if (this->info.bindings.size() <= index) { return index; };
+            this->bindingReferences.resize(std::max(bindingReferences.size(), info.bindings.size()));
+            if (bindingReferences[index] > 1u) {
+                this->bindingReferences[index]--;
+                index = this->allocateBindingSlot();
+            } else {
+                this->forgetBinding(index);
+                if (index < encodedBuffers.size() && encodedBuffers[index].range() > 0ull && encodedBuffers[index].deviceAddress() != binding->ptr.data) { this->retireEncodedBuffer(index); };
+            };
+            this->info.bindings[index] = binding;
+            this->info.bindings[index].format = this->validateAlignment(binding);
+            this->bindings->markDirty(index);
             return index;
         };
 
+        // format with aligned bit, when every element may be loaded at once
+        static uint32_t validateAlignment(const BindingInfo& binding) 
+        {
+            const uint32_t format = binding.format & BindingFormatMask;
+            const VkDeviceSize alignment = getFormatStride(BindingFormat(format));
+            const bool aligned = (binding.ptr.data % alignment) == 0ull && (binding.stride % alignment) == 0u;
+            return format | (aligned ? BindingAlignedBit : 0u);
+        };
+
+        // 
+        static VkDeviceSize getFormatStride(BindingFormat format) 
+        {
+            if (format == BindingFormat::Half4 || format == BindingFormat::Snorm16x4) { return 8ull; };
+            if (format == BindingFormat::Unorm8x4 || format == BindingFormat::Octahedral || format == BindingFormat::Unorm10x3A2) { return 4ull; };
+            return 16ull;
+        };
+
+        // CPU side of readBinding4
+        static std::vector<uint8_t> encodeBinding(const std::vector<glm::vec4>& data, BindingFormat format) 
+        {
+            const VkDeviceSize stride = getFormatStride(format);
+            std::vector<uint8_t> encoded(data.size() * stride);
+            for (uintptr_t i = 0; i < data.size(); i++) {
+                uint8_t* dst = &encoded[i * stride];
+                const glm::vec4& value = data[i];
+                switch (format) {
+                    case BindingFormat::Half4: { glm::u16vec4 v = glm::packHalf(value); memcpy(dst, &v, 8u); break; };
+                    case BindingFormat::Snorm16x4: { glm::i16vec4 v = glm::packSnorm<int16_t>(value); memcpy(dst, &v, 8u); break; };
+                    case BindingFormat::Unorm8x4: { uint32_t v = glm::packUnorm4x8(value); memcpy(dst, &v, 4u); break; };
+                    case BindingFormat::Unorm10x3A2: { uint32_t v = glm::packUnorm3x10_1x2(value); memcpy(dst, &v, 4u); break; };
+                    case BindingFormat::Octahedral: {
+                        glm::vec3 n = glm::vec3(value) / std::max(glm::abs(value.x) + glm::abs(value.y) + glm::abs(value.z), 1e-20f);
+                        glm::vec2 e = glm::vec2(n.x, n.y);
+                        if (n.z < 0.f) { e = (1.f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(e.x >= 0.f ? 1.f : -1.f, e.y >= 0.f ? 1.f : -1.f); };
+                        uint32_t v = glm::packSnorm2x16(e); memcpy(dst, &v, 4u); break;
+                    };
+                    default: { memcpy(dst, &value, 16u); break; };
+                };
+            };
+            return encoded;
+        };
+
+        // encoded into own (pooled) buffer, uploaded with batch
+        virtual uintptr_t pushEncodedBinding(const std::vector<glm::vec4>& data, BindingFormat format, vkh::uni_ptr<TransferBatch> batch) 
+        {
+            const auto encoded = encodeBinding(data, format);
+            auto buffer = createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, .size = std::max(VkDeviceSize(encoded.size()), VkDeviceSize(16u)), .pooled = true });
+            if (encoded.size() > 0ull) { batch->pushUpload(buffer, encoded.data(), encoded.size()); };
+
+            // deduplicated into existing slot, then own buffer isn't needed
+            const uintptr_t index = this->pushBinding(BindingInfo{ .format = uint32_t(format), .stride = uint32_t(getFormatStride(format)), .ptr = { .data = buffer.deviceAddress() } });
+            if (info.bindings[index].ptr.data != buffer.deviceAddress()) { this->retiredEncodedBuffers.push_back(Retired<vkf::VectorBase>{ buffer, recordingFrame }); return index; };
+            if (encodedBuffers.size() <= index) { this->encodedBuffers.resize(index + 1u); };
+            this->encodedBuffers[index] = buffer;
+            return index;
+        };
+
+        //
+        virtual VkDeviceSize getUsedSize() const 
+        {
+            VkDeviceSize used = 0ull;
+            for (auto& stream : streams) { used += this->alignStream(stream.second.size); };
+            return used;
+        };
+
+        // zero when free space is one range
+        virtual float getFragmentation() const 
+        {
+            VkDeviceSize total = 0ull, largest = 0ull;
+            for (auto& range : freeRanges) { total += range.second; largest = std::max(largest, range.second); };
+            return total > 0ull ? (1.f - float(largest) / float(total)) : 0.f;
+        };
+
+        // packed copy of every stream into new arena (copies recorded into batch after its earlier uploads, old arena retained by batch), bindings republished
+        virtual void relocateStreams(vkh::uni_ptr<TransferBatch> batch, VkDeviceSize capacity = 0ull) 
+        {
+            capacity = std::max(capacity > 0ull ? capacity : arenaCapacity, this->getUsedSize());
+            auto previous = this->arena;
+            auto created = createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, .size = capacity });
+
+            // streams uploaded into old arena by same batch are copied after them
+            batch->nextPhase();
+            if (previous.range() > 0ull) { batch->retain(previous); };
+
+            //
+            std::map<VkDeviceSize, GeometryStream> packed = {};
+            VkDeviceSize offset = 0ull;
+            auto& relocation = this->relocations.emplace_back();
+            for (auto& [previousOffset, stream] : streams) {
+                batch->pushCopy(vkh::VkDescriptorBufferInfo{ .buffer = VkBuffer(previous), .offset = previous.offset() + previousOffset, .range = stream.size }, vkh::VkDescriptorBufferInfo{ .buffer = VkBuffer(created), .offset = created.offset() + offset, .range = stream.size });
+                relocation[previous.deviceAddress() + previousOffset] = created.deviceAddress() + offset;
+                if (stream.binding >= 0) {
+                    this->info.bindings[stream.binding].ptr.data = created.deviceAddress() + offset;
+                    this->bindings->markDirty(stream.binding);
+                };
+                packed[offset] = stream;
+                offset += this->alignStream(stream.size);
+            };
+
+            //
+            this->arena = created;
+            this->arenaCapacity = capacity;
+            this->streams = packed;
+            this->freeRanges.clear();
+            if (offset < capacity) { this->freeRanges[offset] = capacity - offset; };
+            this->relocationGeneration++;
+        };
+
+        // defragmentation, when free space is split (then levels should remap index pointers)
+        virtual bool compactStreams(vkh::uni_ptr<TransferBatch> batch, float threshold = 0.5f) 
+        {
+            if (this->getFragmentation() < threshold) { return false; };
+            this->relocateStreams(batch, arenaCapacity);
+            return true;
+        };
+
+        // new address of index stream, through every relocation since generation of address
+        virtual VkDeviceAddress remapAddress(VkDeviceAddress address, uint64_t sinceGeneration) const 
+        {
+            for (uint64_t generation = sinceGeneration; generation < relocations.size(); generation++) {
+                auto found = relocations[generation].find(address);
+                if (found != relocations[generation].end()) { address = found->second; };
+            };
+            return address;
+        };
+
+        //
+        virtual uint64_t getRelocationGeneration() const {
+            return relocationGeneration;
+        };
+
+        // copied into arena with batch, binding pointer managed by registry
+        virtual uintptr_t pushStream(const void* data, VkDeviceSize size, vkh::uni_arg<BindingInfo> binding, vkh::uni_ptr<TransferBatch> batch) 
+        {
+            const VkDeviceSize offset = this->allocateStream(size, batch);
+            batch->pushUpload(vkh::VkDescriptorBufferInfo{ .buffer = VkBuffer(arena), .offset = arena.offset() + offset, .range = size }, data, size);
+
+            //
+            BindingInfo value = binding;
+            value.ptr.data = arena.deviceAddress() + offset;
+            const uintptr_t index = this->allocateBindingSlot();
+            this->info.bindings[index] = value;
+            this->info.bindings[index].format = this->validateAlignment(value);
+            this->bindings->markDirty(index);
+            this->streams[offset] = GeometryStream{ .size = size, .binding = intptr_t(index) };
+            return index;
+        };
+
+        // for index pointer of geometry, which is remapped by level after relocation
+        virtual VkDeviceAddress pushIndexStream(const void* data, VkDeviceSize size, vkh::uni_ptr<TransferBatch> batch) 
+        {
+            const VkDeviceSize offset = this->allocateStream(size, batch);
+            batch->pushUpload(vkh::VkDescriptorBufferInfo{ .buffer = VkBuffer(arena), .offset = arena.offset() + offset, .range = size }, data, size);
+            this->streams[offset] = GeometryStream{ .size = size, .binding = -1 };
+            return arena.deviceAddress() + offset;
+        };
+
+        // range reused by next streams (binding entry stays, until removed)
+        virtual bool freeStream(VkDeviceAddress address) 
+        {
+            if (arenaCapacity <= 0ull || address < arena.deviceAddress()) { return false; };
+            VkDeviceSize offset = address - arena.deviceAddress();
+            auto found = streams.find(offset);
+            if (found == streams.end()) { return false; };
+            VkDeviceSize size = this->alignStream(found->second.size);
+            this->streams.erase(found);
+
+            // merge with neighbours
+            auto next = freeRanges.lower_bound(offset);
+            if (next != freeRanges.end() && next->first == (offset + size)) {
+                size += next->second;
+                next = freeRanges.erase(next);
+            };
+            if (next != freeRanges.begin()) {
+                auto prev = std::prev(next);
+                if ((prev->first + prev->second) == offset) { prev->second += size; return true; };
+            };
+            this->freeRanges[offset] = size;
+            return true;
+        };
+
+        // index with generation, for detection of stale identifiers
+        virtual uint64_t getBindingId(uintptr_t index) 
+        {
+            this->bindingGenerations.resize(std::max(bindingGenerations.size(), info.bindings.size()));
+            return (uint64_t(bindingGenerations[index]) << 32ull) | uint64_t(index);
+        };
+
+        //
+        virtual bool isBindingValid(uint64_t bindingId) const 
+        {
+            const uintptr_t index = uintptr_t(bindingId & 0xFFFFFFFFull);
+            if (index >= info.bindings.size()) { return false; };
+            const uint32_t generation = index < bindingGenerations.size() ? bindingGenerations[index] : 0u;
+            return generation == uint32_t(bindingId >> 32ull) && std::find(freeBindings.begin(), freeBindings.end(), index) == freeBindings.end();
+        };
+
+        // by last owner, slot cleared and reused by next binding, own stream released into arena (others only drop reference)
+        virtual bool removeBinding(uintptr_t index) 
+        {
+            if (index >= info.bindings.size() || std::find(freeBindings.begin(), freeBindings.end(), index) != freeBindings.end()) { return false; };
+            this->bindingGenerations.resize(std::max(bindingGenerations.size(), info.bindings.size()));
+            this->bindingReferences.resize(std::max(bindingReferences.size(), info.bindings.size()));
+            if (bindingReferences[index] > 1u) { this->bindingReferences[index]--; return true; };
+            this->bindingReferences[index] = 0u;
+
+            //
+            for (auto& stream : streams) {
+                if (stream.second.binding == intptr_t(index)) { this->freeStream(arena.deviceAddress() + stream.first); break; };
+            };
+            this->forgetBinding(index);
+            this->retireEncodedBuffer(index);
+            this->info.bindings[index] = BindingInfo{ .format = 0u, .stride = 0u };
+            this->bindings->markDirty(index);
+            this->bindingGenerations[index]++;
+            this->freeBindings.push_back(index);
+            return true;
+        };
+
+        //
+        virtual bool removeBinding(uint64_t bindingId, bool checked) 
+        {
+            if (checked && !this->isBindingValid(bindingId)) { return false; };
+            return this->removeBinding(uintptr_t(bindingId & 0xFFFFFFFFull));
+        };
+
+        // tail bindings moved into free slots, table shrunk (only moved slots uploaded), remap is old to new index or -1 (levels remapped by GeometryLevel::remapBindings)
+        virtual std::vector<intptr_t> compactBindings() 
+        {
+            std::vector<intptr_t> remap(info.bindings.size());
+            std::vector<bool> removed(info.bindings.size(), false);
+            for (auto& index : freeBindings) { removed[index] = true; };
+            for (uintptr_t i = 0; i < remap.size(); i++) { remap[i] = removed[i] ? -1 : intptr_t(i); };
+            this->bindingGenerations.resize(std::max(bindingGenerations.size(), info.bindings.size()));
+            this->bindingReferences.resize(std::max(bindingReferences.size(), info.bindings.size()));
+
+            // last live binding into first hole
+            std::sort(freeBindings.begin(), freeBindings.end());
+            uintptr_t count = info.bindings.size();
+            for (auto& slot : freeBindings) {
+                while (count > 0u && removed[count - 1u]) { count--; };
+                if (slot >= count) { break; };
+
+                //
+                const uintptr_t last = count - 1u;
+                this->info.bindings[slot] = info.bindings[last];
+                this->bindingReferences[slot] = bindingReferences[last];
+                if (last < encodedBuffers.size()) { this->encodedBuffers[slot] = encodedBuffers[last]; this->encodedBuffers[last] = vkf::VectorBase{}; };
+                this->bindings->markDirty(slot);
+                this->forgetBinding(last);
+                for (auto& stream : streams) { if (stream.second.binding == intptr_t(last)) { stream.second.binding = intptr_t(slot); }; };
+                this->bindingGenerations[last]++;
+                removed[slot] = false;
+                removed[last] = true;
+                remap[last] = intptr_t(slot);
+                count--;
+            };
+
+            //
+            while (count > 0u && removed[count - 1u]) { count--; };
+            this->info.bindings.resize(count);
+            this->bindingReferences.resize(count);
+            this->encodedBuffers.resize(std::min(encodedBuffers.size(), count));
+            this->freeBindings.clear();
+            this->bindingRemaps.push_back(remap);
+            return remap;
+        };
+
+        //
+        virtual uint64_t getCompactionGeneration() const {
+            return bindingRemaps.size();
+        };
+
+        // new index of binding, through every compaction since generation (removed are kept as is)
+        virtual intptr_t remapBinding(intptr_t index, uint64_t sinceGeneration) const 
+        {
+            for (uint64_t generation = sinceGeneration; generation < bindingRemaps.size(); generation++) {
+                const auto& remap = bindingRemaps[generation];
+                if (index < 0 || uintptr_t(index) >= remap.size() || remap[index] < 0) { return index; };
+                index = remap[index];
+            };
+            return index;
+        };
+
+        // binding with same content, or -1
+        virtual intptr_t findBinding(uint64_t contentHash, uint32_t format = 0u, uint32_t stride = 16u) const 
+        {   
+            auto found = contentIndices.find(hashCombine(hashCombine(contentHash, format), stride));
+            return found != contentIndices.end() ? intptr_t(found->second) : -1;
+        };
+
         //
         virtual uintptr_t pushBufferWithBinding(vkh::VkDescriptorBufferInfo buffer, vkh::uni_arg<BindingInfo> binding) 
         {   
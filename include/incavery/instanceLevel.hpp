@@ -4,6 +4,9 @@
 #include "./core.hpp"
 #include "./geometryRegistry.hpp"
 #include "./geometryLevel.hpp"
+#include "./scratchArena.hpp"
+#include <future>
+#include <thread>
 
 // 
 namespace icv {
@@ -39,12 +42,22 @@ namespace icv {
         };
     };
 
+    // top levels traced together (layer zero is level which owns descriptor set), same as INSTANCE_LAYER_COUNT
+    constexpr uint32_t maxInstanceLayers = 4u;
+
     // 
     struct InstanceLevelInfo 
     {
         std::vector<InstanceInfo> instances = {};
 
-        uint32_t maxInstanceCount = 128u;
+        uint32_t maxInstanceCount = 128u; // initial capacity, grows when exceeded
+        vkh::uni_ptr<ScratchArena> scratchArena = {}; // shared scratch, otherwise own
+        BuildPolicy policy = { .quality = BuildQuality::FastTrace, .allowUpdate = true }; // compaction isn't used by top level, update when only transforms moved
+        uint32_t packingThreads = 0u; // CPU packing of native instances, zero is hardware concurrency
+        uint32_t packingChunk = 16384u; // least dirty instances per thread (fewer are packed on calling thread)
+        bool deviceNativeInstances = false; // native instances written by compute (nativeInstances.comp) of renderer, only instance infos uploaded (packed by CPU without pipeline)
+        uint32_t stagingCount = 1u;
+        DataSetMemory memory = DataSetMemory::Auto;
     };
 
     // 
@@ -67,6 +80,38 @@ namespace icv {
         VkAccelerationStructureKHR acceleration = VK_NULL_HANDLE;
         vkf::VectorBase accStorage = {};
         vkf::VectorBase accScratch = {};
+        std::vector<Retired<vkf::VectorBase>> retiredScratch = {}; // own scratch of recorded builds (released by releaseScratch or releaseRetired)
+        VkDeviceSize scratchSize = 0ull;
+        VkDeviceSize updateScratchSize = 0ull;
+
+        // refit state, rebuilt when instances added, removed or changed other than transform
+        bool built = false;
+        bool topologyChanged = true;
+        uintptr_t builtCount = 0ull;
+        bool pendingBuild = true; // instances changed since last build (dirty ranges are cleared by batch flush)
+        std::vector<InstanceInfo> packedInstances = {}; // CPU copy of last packed or uploaded, compared instead of mapped staging (write-combined, other slice of ring)
+        uint32_t refitCount = 0u;
+
+        // acceleration structure is sized by capacity of native instances
+        uint64_t builtGeneration = 0ull;
+
+        // auto quality, promoted to fast trace when static long enough (flags fixed until re-make)
+        uint32_t staticFrames = 0u;
+        bool promoted = false;
+        bool promotePending = false;
+
+        // replaced by re-make, may be still traced by frames in flight (destroyed by releaseRetired)
+        std::vector<Retired<AccelerationStorage>> retiredAccelerations = {};
+
+        // for rewrite, when instance buffer grown or acceleration structure re-made
+        DescriptorInfo descriptorInfo = {};
+        uint64_t descriptorGeneration = 0ull;
+        VkAccelerationStructureKHR descriptorAcceleration = VK_NULL_HANDLE;
+
+        // other top levels (static, dynamic, transient), unused slots repeat own
+        std::vector<vkh::uni_ptr<InstanceLevel>> layers = {};
+        std::vector<VkAccelerationStructureKHR> descriptorLayers = {};
+        vkf::VectorBase layerInfo = {}; // count and mask of layers, for traceRays
 
         //
         virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<InstanceLevelInfo> info = InstanceLevelInfo{}) 
@@ -76,12 +121,16 @@ namespace icv {
 
             this->instances = std::make_shared<DataSet<InstanceInfo>>(device, DataSetInfo{
                 .count = info->maxInstanceCount,
-                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                .stagingCount = info->stagingCount,
+                .memory = info->memory
             });
 
             this->nativeInstances = std::make_shared<DataSet<vkh::VkAccelerationStructureInstanceKHR>>(device, DataSetInfo{
                 .count = info->maxInstanceCount,
-                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                .stagingCount = info->stagingCount,
+                .memory = info->memory
             });
         };
 
@@ -89,6 +138,11 @@ namespace icv {
         InstanceLevel() {};
         InstanceLevel(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<InstanceLevelInfo> info = InstanceLevelInfo{}) { this->constructor(device, info); };
 
+        // pooled layer info, when no longer used by device
+        ~InstanceLevel() {
+            if (layerInfo.range() > 0ull) { this->releaseBuffer(layerInfo); };
+        };
+
         //
         virtual const VkDescriptorSet& getDescriptorSet() const {
             return set;
@@ -99,16 +153,11 @@ namespace icv {
             return set;
         };
 
-        //
+        // read only, instances are changed by changeInstance or writeTransform (then markDirty)
         virtual const InstanceLevelInfo& getInfo() const {
             return info;
         };
 
-        //
-        virtual InstanceLevelInfo& getInfo() {
-            return info;
-        };
-
         //
         virtual const vkf::Vector<vkh::VkAccelerationStructureInstanceKHR>& getBuffer() const {
             return nativeInstances->getDeviceBuffer();
@@ -119,9 +168,23 @@ namespace icv {
             return nativeInstances->getDeviceBuffer();
         };
 
+        // when native instances reallocated, address and size are stale
+        virtual bool isAccelerationStale() const {
+            return !acceleration || builtGeneration != nativeInstances->getGeneration() || promotePending;
+        };
+
+        // once per frame, promotes auto quality level (re-made with fast trace)
+        virtual void advanceFrame() {
+            if (pendingBuild || instances->isDirty()) { this->staticFrames = 0u; return; };
+            this->staticFrames++;
+            if (info.policy.quality == BuildQuality::Auto && !promoted && staticFrames >= info.policy.promoteAfterFrames) {
+                this->promotePending = true;
+            };
+        };
+
         //
         virtual VkDeviceAddress getDeviceAddress() {
-            if (!acceleration) { this->makeAccelerationStructure(); };
+            if (this->isAccelerationStale()) { this->makeAccelerationStructure(); };
             return device->dispatch->GetAccelerationStructureDeviceAddressKHR(&(deviceAddressInfo = acceleration));
         };
 
@@ -137,26 +200,38 @@ namespace icv {
             auto indexedf = vkh::VkDescriptorBindingFlags{ .eUpdateAfterBind = 1, .eUpdateUnusedWhilePending = 1, .ePartiallyBound = 1 };
             auto dflags = vkh::VkDescriptorSetLayoutCreateFlags{ .eUpdateAfterBindPool = 1 };
 
-            {   // create descriptor set layout
-                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{});
+            {   // update after bind, rewritten when instances grow or structures are re-made
+                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{ .flags = dflags });
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 0u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     .descriptorCount = 1u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 1u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
-                    .descriptorCount = 1u,
+                    .descriptorCount = maxInstanceLayers,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 2u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     .descriptorCount = 256u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
+                descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
+                    .binding = 3u,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .descriptorCount = maxInstanceLayers,
+                    .stageFlags = pipusage
+                }, indexedf);
+                descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
+                    .binding = 4u,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .descriptorCount = 1u,
+                    .stageFlags = pipusage
+                }, indexedf);
                 vkt::handleVk(device->dispatch->CreateDescriptorSetLayout(descriptorSetLayoutHelper.format(), nullptr, &descriptorSetLayout));
             };
             return descriptorSetLayout;
@@ -165,7 +240,7 @@ namespace icv {
         //
         virtual VkDescriptorSet& makeDescriptorSet(vkh::uni_arg<DescriptorInfo> info = DescriptorInfo{}) 
         {
-            if (!acceleration) {
+            if (this->isAccelerationStale()) {
                 this->makeAccelerationStructure();
             };
 
@@ -177,48 +252,328 @@ namespace icv {
                 .descriptorCount = 1u,
                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
             }) = instances->getDeviceBuffer();
-            descriptorSetHelper.pushDescription<VkAccelerationStructureKHR>(vkh::VkDescriptorUpdateTemplateEntry
+
+            // layers, with own in unused slots
+            std::vector<VkAccelerationStructureKHR> layerAccelerations(maxInstanceLayers, acceleration);
+            std::vector<vkh::VkDescriptorBufferInfo> layerInstances(maxInstanceLayers, instances->getDeviceBuffer());
+            for (uint32_t i = 0u; i < layers.size(); i++) {
+                if (!layers[i].has()) { continue; };
+                layerAccelerations[i + 1u] = layers[i]->getAccelerationStructure();
+                layerInstances[i + 1u] = layers[i]->getInstanceBuffer();
+            };
+            {
+                auto handle = descriptorSetHelper.pushDescription<VkAccelerationStructureKHR>(vkh::VkDescriptorUpdateTemplateEntry
+                {
+                    .dstBinding = 1u,
+                    .descriptorCount = maxInstanceLayers,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR
+                });
+                memcpy(&handle, layerAccelerations.data(), layerAccelerations.size() * sizeof(VkAccelerationStructureKHR));
+            };
+            {
+                auto handle = descriptorSetHelper.pushDescription<vkh::VkDescriptorBufferInfo>(vkh::VkDescriptorUpdateTemplateEntry
+                {
+                    .dstBinding = 3u,
+                    .descriptorCount = maxInstanceLayers,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                });
+                memcpy(&handle, layerInstances.data(), layerInstances.size() * sizeof(vkh::VkDescriptorBufferInfo));
+            };
+
+            //
+            if (layerInfo.range() <= 0ull) {
+                this->layerInfo = createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, .size = sizeof(glm::uvec4), .pooled = true });
+            };
+            descriptorSetHelper.pushDescription<vkh::VkDescriptorBufferInfo>(vkh::VkDescriptorUpdateTemplateEntry
             {
-                .dstBinding = 1u,
+                .dstBinding = 4u,
                 .descriptorCount = 1u,
-                .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR
-            }) = acceleration;
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+            }) = layerInfo;
 
             vkt::AllocateDescriptorSetWithUpdate(device->dispatch, descriptorSetHelper, set, created);
+            this->descriptorInfo = info;
+            this->descriptorGeneration = instances->getGeneration();
+            this->descriptorAcceleration = acceleration;
+            this->descriptorLayers = layerAccelerations;
             return set;
         };
 
-        // TODO: copy buffer
-        virtual void buildCommand(VkCommandBuffer commandBuffer) 
+        // rewrite descriptor set, when instance buffer, own or layer acceleration structure changed
+        virtual void republishDescriptorSet() 
+        {   // 
+            if (!created) { return; };
+            bool changed = descriptorGeneration != instances->getGeneration() || descriptorAcceleration != acceleration;
+            for (uint32_t i = 0u; i < layers.size() && !changed; i++) {
+                if (layers[i].has() && (layers[i]->isAccelerationStale() || descriptorLayers[i + 1u] != layers[i]->getAccelerationStructure())) { changed = true; };
+            };
+            if (changed) { this->makeDescriptorSet(descriptorInfo); };
+        };
+
+        // other top level traced with this (layer zero), rebuilt independently (static layer built once)
+        virtual void setLayer(uint32_t layerId, vkh::uni_ptr<InstanceLevel> layer) 
+        {
+            if (layerId <= 0u || layerId >= maxInstanceLayers) { std::cerr << "Instance layer out of range" << std::endl; return; };
+            if (layers.size() < layerId) { this->layers.resize(layerId); };
+            this->layers[layerId - 1u] = layer;
+            if (created) { this->makeDescriptorSet(descriptorInfo); };
+        };
+
+        //
+        virtual const std::vector<vkh::uni_ptr<InstanceLevel>>& getLayers() const {
+            return layers;
+        };
+
+        // own and attached (empty slots aren't counted)
+        virtual uint32_t getLayerCount() const {
+            uint32_t count = 1u;
+            for (auto& layer : layers) { if (layer.has()) { count++; }; };
+            return count;
+        };
+
+        // bit of every traced slot, own (zero) is always
+        virtual uint32_t getLayerMask() const {
+            uint32_t mask = 1u;
+            for (uint32_t i = 0u; i < layers.size(); i++) { if (layers[i].has()) { mask |= 1u << (i + 1u); }; };
+            return mask;
+        };
+
+        // count and mask of layers for traceRays, recorded before trace
+        virtual void layerInfoCommand(VkCommandBuffer commandBuffer) 
+        {
+            if (layerInfo.range() <= 0ull) { return; };
+            const glm::uvec4 data = glm::uvec4(this->getLayerCount(), this->getLayerMask(), 0u, 0u);
+            device->dispatch->CmdUpdateBuffer(commandBuffer, VkBuffer(layerInfo), layerInfo.offset(), sizeof(glm::uvec4), &data);
+        };
+
+        //
+        virtual VkAccelerationStructureKHR getAccelerationStructure() {
+            if (this->isAccelerationStale()) { this->makeAccelerationStructure(); };
+            return acceleration;
+        };
+
+        //
+        virtual vkh::VkDescriptorBufferInfo getInstanceBuffer() {
+            return instances->getDeviceBuffer();
+        };
+
+        // unchanged layer isn't rebuilt
+        virtual bool isDirty() {
+            return !built || pendingBuild || this->isAccelerationStale() || instances->isDirty();
+        };
+
+        // without bounds checks, true when changed other than transform (native is only written)
+        static bool packNativeInstance(const InstanceInfo& instance, InstanceInfo& previous, vkh::VkAccelerationStructureInstanceKHR* native) 
+        {
+            vkh::VkAccelerationStructureInstanceKHR packed = {};
+            memcpy(&packed.transform, &instance.transform, sizeof(VkTransformMatrixKHR)); // three 16-byte rows
+            packed.accelerationStructureReference = instance.accelerationReference;
+            packed.instanceShaderBindingTableRecordOffset = instance.sbtOffsetId;
+            packed.mask = instance.mask;
+            packed.flags = instance.flags;
+            packed.instanceCustomIndex = *((const uint16_t*)&instance.customIndex);
+
+            //
+            const uintptr_t offset = offsetof(InstanceInfo, mask);
+            const bool changed = memcmp(reinterpret_cast<const uint8_t*>(&previous) + offset, reinterpret_cast<const uint8_t*>(&instance) + offset, sizeof(InstanceInfo) - offset) != 0;
+            previous = instance;
+            *native = packed;
+            return changed;
+        };
+
+        // set native instances directly (only changed) into mapped staging, chunks split between threads
+        virtual void packNativeInstances() 
+        {
+            nativeInstances->reserve(info.instances.size());
+            this->packedInstances.resize(info.instances.size());
+            if (info.instances.size() <= 0ull) { return; };
+
+            // dirty instances, clamped to instance count
+            uintptr_t dirtyCount = 0ull;
+            const auto ranges = instances->getDirtyRanges();
+            for (auto& range : ranges) {
+                if (range.offset < info.instances.size()) { dirtyCount += std::min(range.count, uintptr_t(info.instances.size()) - range.offset); };
+            };
+
+            // threads are launched per call (tens of microseconds), so only by whole chunks of total dirty count (not per range)
+            const uintptr_t threadLimit = info.packingThreads > 0u ? info.packingThreads : std::max(std::thread::hardware_concurrency(), 1u);
+            const uintptr_t threadCount = std::max(std::min(threadLimit, dirtyCount / std::max(uintptr_t(info.packingChunk), uintptr_t(1u))), uintptr_t(1u));
+
+            // even share of dirty instances by thread, ranges split at share boundaries
+            std::vector<std::vector<DataSetRange>> shares(threadCount);
+            const uintptr_t share = std::max(uintptr_t((dirtyCount + threadCount - 1u) / threadCount), uintptr_t(1u));
+            uintptr_t filled = 0ull;
+            for (auto& range : ranges) {
+                const uintptr_t end = std::min(range.offset + range.count, uintptr_t(info.instances.size()));
+                for (uintptr_t offset = range.offset; offset < end;) {
+                    const uintptr_t count = std::min(end - offset, share - (filled % share));
+                    shares[std::min(filled / share, uintptr_t(threadCount - 1u))].push_back(DataSetRange{ .offset = offset, .count = count });
+                    offset += count, filled += count;
+                };
+            };
+
+            //
+            vkh::VkAccelerationStructureInstanceKHR* natives = &nativeInstances->getCpuCache()[0u];
+            const InstanceInfo* source = info.instances.data();
+            InstanceInfo* previous = packedInstances.data();
+            auto packShare = [&shares, natives, source, previous](uintptr_t t) {
+                bool changed = false;
+                for (auto& range : shares[t]) {
+                    for (uintptr_t i = range.offset; i < (range.offset + range.count); i++) { changed |= packNativeInstance(source[i], previous[i], natives + i); };
+                };
+                return changed;
+            };
+
+            //
+            std::vector<std::future<bool>> tasks = {};
+            for (uintptr_t t = 1ull; t < threadCount; t++) { tasks.push_back(std::async(std::launch::async, packShare, t)); };
+            bool changed = packShare(0ull);
+            for (auto& task : tasks) { changed |= task.get(); };
+            if (changed) { this->topologyChanged = true; };
+
+            //
+            for (auto& range : ranges) { nativeInstances->markDirty(range.offset, range.count); };
+        };
+
+        // with native instances on device, previous instance infos are compared instead
+        virtual void detectTopologyChange() 
+        {
+            const uintptr_t offset = offsetof(InstanceInfo, mask);
+            this->packedInstances.resize(info.instances.size());
+            for (auto& range : instances->getDirtyRanges()) {
+                const uintptr_t count = std::min(range.offset + range.count, uintptr_t(info.instances.size()));
+                for (uintptr_t i = range.offset; i < count; i++) {
+                    if (memcmp(reinterpret_cast<const uint8_t*>(&packedInstances[i]) + offset, reinterpret_cast<const uint8_t*>(&info.instances[i]) + offset, sizeof(InstanceInfo) - offset)) { this->topologyChanged = true; };
+                    this->packedInstances[i] = info.instances[i];
+                };
+            };
+        };
+
+        //
+        virtual bool usesDeviceNativeInstances() const {
+            return info.deviceNativeInstances;
+        };
+
+        // push constants of nativeInstances.comp (address of native instances, count, and layer of instance infos)
+        virtual glm::uvec4 getNativeConstants(uint32_t layerId = 0u) 
+        {
+            const VkDeviceAddress address = nativeInstances->getDeviceBuffer().deviceAddress();
+            return glm::uvec4(uint32_t(address & 0xFFFFFFFFull), uint32_t(address >> 32ull), uint32_t(info.instances.size()), layerId);
+        };
+
+        // pack or compare, then copy instance infos (native instances are stale until uploaded or generated)
+        virtual void prepareUpload(bool deviceNative = false) 
+        {
+            if (instances->isDirty()) { this->pendingBuild = true; };
+            if (deviceNative) { this->detectTopologyChange(); } else { this->packNativeInstances(); };
+            instances->copyFromVector(info.instances);
+            if (this->isAccelerationStale()) { this->makeAccelerationStructure(); };
+            this->republishDescriptorSet();
+        };
+
+        // 
+        virtual void enqueueUpload(vkh::uni_ptr<TransferBatch> batch, bool deviceNative = false)
+        {   // 
+            this->prepareUpload(deviceNative);
+            if (!deviceNative) { batch->pushDataSet(nativeInstances); };
+            batch->pushDataSet(instances);
+        };
+
+        //
+        virtual void uploadCommand(VkCommandBuffer commandBuffer, bool deviceNative = false) 
+        {
+            this->prepareUpload(deviceNative);
+            if (!deviceNative) { nativeInstances->cmdCopyFromCpu(commandBuffer); };
+            instances->cmdCopyFromCpu(commandBuffer);
+        };
+
+        //
+        virtual bool isUpdate() const {
+            return buildInfo.info.mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+        };
+
+        // refit in place, when only transforms moved (quality decays, so rebuilt after threshold)
+        virtual void prepareBuild() 
         {
-            // set native instances directly
-            for (intptr_t i = 0; i < info.instances.size();i++) {
-                nativeInstances->getCpuCache().at(i) = vkh::VkAccelerationStructureInstanceKHR{};
-                nativeInstances->getCpuCache().at(i).transform = info.instances[i].transform;
-                nativeInstances->getCpuCache().at(i).accelerationStructureReference = info.instances[i].accelerationReference;
-                nativeInstances->getCpuCache().at(i).instanceShaderBindingTableRecordOffset = info.instances[i].sbtOffsetId;
-                nativeInstances->getCpuCache().at(i).mask = info.instances[i].mask;
-                nativeInstances->getCpuCache().at(i).flags = info.instances[i].flags;
-                nativeInstances->getCpuCache().at(i).instanceCustomIndex = *((uint16_t*)&info.instances[i].customIndex);
+            const bool refit = info.policy.allowUpdate && built && !topologyChanged && builtCount == info.instances.size() && (info.policy.rebuildThreshold == 0u || refitCount < info.policy.rebuildThreshold);
+            if (refit) {
+                buildInfo.info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+                buildInfo.info.srcAccelerationStructure = this->acceleration;
+                this->refitCount++;
+            } else {
+                buildInfo.info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+                buildInfo.info.srcAccelerationStructure = VK_NULL_HANDLE;
+                this->refitCount = 0u;
             };
+        };
+
+        //
+        virtual void markBuilt() {
+            this->built = true;
+            this->topologyChanged = false;
+            this->builtCount = info.instances.size();
+            this->pendingBuild = false;
+        };
 
-            if (!acceleration) { this->makeAccelerationStructure(); };
-            {   // TODO: indirect condition
-                nativeInstances->cmdCopyFromCpu(commandBuffer);
-                instances->copyFromVector(info.instances);
-                instances->cmdCopyFromCpu(commandBuffer);
+        // from shared arena or own (created on demand)
+        virtual void acquireScratchCommand(VkCommandBuffer commandBuffer) 
+        {
+            const VkDeviceSize scratchSize = this->isUpdate() ? updateScratchSize : this->scratchSize;
+            if (info.scratchArena.has()) {
+                info.scratchArena->cmdReuseBarrier(commandBuffer);
+                buildInfo.info.scratchData.deviceAddress = info.scratchArena->acquire(scratchSize);
+                return;
+            };
+            if (accScratch.range() < scratchSize) {
+                if (accScratch.range() > 0ull) { this->retiredScratch.push_back(Retired<vkf::VectorBase>{ accScratch, recordingFrame }); };
+                this->accScratch = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = scratchSize});
             };
+            buildInfo.info.scratchData.deviceAddress = accScratch.deviceAddress();
+        };
+
+        // after upload (and generation of native instances, when on device)
+        virtual void buildAccelerationCommand(VkCommandBuffer commandBuffer) 
+        {
+            if (this->isAccelerationStale()) { this->makeAccelerationStructure(); };
             buildInfo.ranges.resize(1u);
             buildInfo.ranges[0u].primitiveCount = info.instances.size();
+            this->prepareBuild();
+            this->acquireScratchCommand(commandBuffer);
 
             const auto ptr = &buildInfo.ranges[0u];
             device->dispatch->CmdBuildAccelerationStructuresKHR(commandBuffer, 1u, &buildInfo.info, &ptr);
+            this->markBuilt();
+
+            // without refit scratch is not kept between builds
+            if (!info.policy.allowUpdate) { this->retireScratch(); };
+        };
+
+        // own scratch, kept until recorded build is completed
+        virtual void retireScratch() 
+        {
+            if (accScratch.range() > 0ull) { this->retiredScratch.push_back(Retired<vkf::VectorBase>{ accScratch, recordingFrame }); };
+            this->accScratch = vkf::VectorBase{};
+        };
+
+        // own scratch and retired since first, when blocking build is completed (earlier are released by releaseRetired)
+        virtual void releaseScratch(uintptr_t first = 0ull) 
+        {
+            this->accScratch = vkf::VectorBase{};
+            this->retiredScratch.resize(std::min(first, uintptr_t(retiredScratch.size())));
+        };
+
+        // native instances packed by CPU, in any mode (device generation is recorded by Renderer::buildInstanceLayer)
+        virtual void buildCommand(VkCommandBuffer commandBuffer) 
+        {
+            this->uploadCommand(commandBuffer);
+            this->buildAccelerationCommand(commandBuffer);
         };
 
         // 
         virtual void makeAccelerationStructure() 
         {
             auto accelerationStructureType = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+            nativeInstances->reserve(info.instances.size());
 
             {   // 
                 buildInfo.builds.resize(1u);
@@ -236,21 +591,27 @@ namespace icv {
                     };
                 };
                 buildInfo.info.type = accelerationStructureType;
-                buildInfo.info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+                this->promoted = info.policy.quality == BuildQuality::Auto && staticFrames >= info.policy.promoteAfterFrames;
+                this->promotePending = false;
+
+                // top level is rebuilt too often, so never compacted (even with low memory quality)
+                buildInfo.info.flags = this->getBuildFlags(info.policy, promoted) & ~VkBuildAccelerationStructureFlagsKHR(VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
                 buildInfo.info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
                 buildInfo.info.geometryCount = buildInfo.builds.size();
                 buildInfo.info.pGeometries = &buildInfo.builds[0];
             };
 
             vkh::VkAccelerationStructureBuildSizesInfoKHR sizes = {};
-            {   // 
-                std::vector<uint32_t> primitiveCount = { uint32_t(info.instances.size()) };
+            {   // sized by capacity, so pushed instances doesn't require re-make
+                std::vector<uint32_t> primitiveCount = { uint32_t(nativeInstances->getCapacity()) };
                 device->dispatch->GetAccelerationStructureBuildSizesKHR(VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo.info, primitiveCount.data(), &sizes);
             };
 
             {   // 
+                this->retireAcceleration();
                 this->accStorage = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = sizes.accelerationStructureSize});
-                this->accScratch = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = sizes.buildScratchSize});
+                this->scratchSize = sizes.buildScratchSize;
+                this->updateScratchSize = sizes.updateScratchSize;
             };
 
             {   // create acceleration structure
@@ -262,8 +623,37 @@ namespace icv {
 
             {   //
                 buildInfo.info.dstAccelerationStructure = this->acceleration;
-                buildInfo.info.scratchData = this->accScratch;
             };
+
+            // 
+            this->builtGeneration = nativeInstances->getGeneration();
+            this->built = false;
+            this->topologyChanged = true;
+        };
+
+        // current handle and storage, kept until frame which retired them is completed
+        virtual void retireAcceleration() 
+        {
+            if (acceleration || accStorage.range() > 0ull) { this->retiredAccelerations.push_back(Retired<AccelerationStorage>{ AccelerationStorage{ acceleration, accStorage }, recordingFrame }); };
+            this->acceleration = VK_NULL_HANDLE;
+            this->accStorage = vkf::VectorBase{};
+        };
+
+        // retired by frames up to completed one, which traced or built them
+        virtual void releaseRetired(uint64_t completedFrame) 
+        {
+            releaseCompleted(retiredAccelerations, completedFrame, [this](AccelerationStorage& retired) { if (retired.handle) { device->dispatch->DestroyAccelerationStructureKHR(retired.handle, nullptr); }; });
+            releaseCompleted(retiredScratch, completedFrame, [](vkf::VectorBase&) {});
+            instances->releaseRetired(completedFrame);
+            nativeInstances->releaseRetired(completedFrame);
+        };
+
+        //
+        virtual void setRecordingFrame(uint64_t frame) override 
+        {
+            this->recordingFrame = frame;
+            instances->setRecordingFrame(frame);
+            nativeInstances->setRecordingFrame(frame);
         };
 
         //
@@ -271,24 +661,50 @@ namespace icv {
         {   // add instance into registry
             if (this->info.instances.size() <= instanceId) { this->info.instances.resize(instanceId + 1u); };
             this->info.instances[instanceId] = info;
+            this->instances->markDirty(instanceId);
             return instanceId;
         };
 
+        // transform only (e.g. by scene graph), uploaded after markDirty
+        virtual bool writeTransform(uintptr_t instanceId, const glm::mat3x4& transform)
+        {
+            if (this->info.instances.size() <= instanceId) { return false; };
+            this->info.instances[instanceId].transform = transform;
+            return true;
+        };
+
+        //
+        virtual void markDirty(uintptr_t instanceId, uintptr_t count = 1ull) {
+            this->instances->markDirty(instanceId, count);
+        };
+
         //
         virtual uintptr_t pushInstance(vkh::uni_arg<InstanceInfo> info = InstanceInfo{})
         {   // add instance into registry
             uintptr_t instanceId = this->info.instances.size();
             this->info.instances.push_back(info);
+            this->instances->markDirty(instanceId);
             return instanceId;
         };
 
+        //
+        virtual void selectStaging(uint32_t frameIndex)
+        {   // 
+            instances->selectStaging(frameIndex);
+            nativeInstances->selectStaging(frameIndex);
+        };
+
         // 
         virtual void flush(vkh::uni_ptr<vkf::Queue> queue = {}) 
         {   // 
+            const uintptr_t retiredCount = retiredScratch.size();
             queue->submitOnce([&,this](VkCommandBuffer commandBuffer) 
             {   // 
                 this->buildCommand(commandBuffer);
             });
+
+            // 
+            if (!info.policy.allowUpdate) { this->releaseScratch(retiredCount); };
         };
 
         //
@@ -297,6 +713,7 @@ namespace icv {
             for (intptr_t i = 0; i < info.instances.size(); i++) {
                 info.instances[i].acceptGeometryLevel(geometries[info.instances[i].geometryLevelId]);
             };
+            this->instances->markDirty(0ull, info.instances.size());
         };
     };
 
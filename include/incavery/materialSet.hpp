@@ -3,6 +3,7 @@
 // 
 #include "./core.hpp"
 #include "./dataSet.hpp"
+#include "./transferBatch.hpp"
 
 // 
 namespace icv {
@@ -30,7 +31,9 @@ namespace icv {
         std::vector<T> materials = {};
         std::vector<vkh::VkDescriptorImageInfo> textures = {};
 
-        uint32_t maxMaterialCount = 128u;
+        uint32_t maxMaterialCount = 128u; // initial capacity, grows when exceeded
+        uint32_t stagingCount = 1u;
+        DataSetMemory memory = DataSetMemory::Auto;
     };
 
 
@@ -40,6 +43,10 @@ namespace icv {
         VkDescriptorSet set = VK_NULL_HANDLE;
         bool created = false;
 
+        // for rewrite, when buffer grown
+        DescriptorInfo descriptorInfo = {};
+        uint64_t descriptorGeneration = 0ull;
+
         public: 
 
         //
@@ -58,6 +65,15 @@ namespace icv {
         //
         virtual void copyCommand(VkCommandBuffer commandBuffer) {};
 
+        //
+        virtual void selectStaging(uint32_t frameIndex) {};
+
+        //
+        virtual void releaseRetired(uint64_t completedFrame) {};
+
+        //
+        virtual void enqueueUpload(vkh::uni_ptr<TransferBatch> batch) {};
+
         //
         virtual void flush(vkh::uni_ptr<vkf::Queue> queue = {}) 
         {   // 
@@ -73,20 +89,20 @@ namespace icv {
             auto dflags = vkh::VkDescriptorSetLayoutCreateFlags{ .eUpdateAfterBindPool = 1 };
 
             if (!descriptorSetLayout) 
-            {   // create descriptor set layout
-                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{});
+            {   // textures and material buffer are updated after bind
+                vkh::VsDescriptorSetLayoutCreateInfoHelper descriptorSetLayoutHelper(vkh::VkDescriptorSetLayoutCreateInfo{ .flags = dflags });
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 0u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                     .descriptorCount = 256u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 descriptorSetLayoutHelper.pushBinding(vkh::VkDescriptorSetLayoutBinding{
                     .binding = 1u,
                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                     .descriptorCount = 1u,
                     .stageFlags = pipusage
-                }, vkh::VkDescriptorBindingFlags{ .ePartiallyBound = 1 });
+                }, indexedf);
                 vkt::handleVk(device->dispatch->CreateDescriptorSetLayout(descriptorSetLayoutHelper.format(), nullptr, &descriptorSetLayout));
             };
 
@@ -110,7 +126,9 @@ namespace icv {
             this->device = device;
             this->materials = std::make_shared<DataSet<M>>(device, DataSetInfo{
                 .count = info->maxMaterialCount,
-                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                .stagingCount = info->stagingCount,
+                .memory = info->memory
             });
         };
 
@@ -119,16 +137,11 @@ namespace icv {
         MaterialSet() {};
         MaterialSet(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<MaterialSetInfo<M>> info = MaterialSetInfo{}) { this->constructor(device, info); };
 
-        //
+        // read only, use setMaterial
         virtual const MaterialSetInfo<M>& getInfo() const {
             return info;
         };
 
-        //
-        virtual MaterialSetInfo<M>& getInfo() {
-            return info;
-        };
-
         //
         virtual const vkf::Vector<M>& getBuffer() const {
             return materials->getDeviceBuffer();
@@ -157,16 +170,52 @@ namespace icv {
                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
             }) = materials->getDeviceBuffer();
             vkt::AllocateDescriptorSetWithUpdate(device->dispatch, descriptorSetHelper, set, created);
+            this->descriptorInfo = info;
+            this->descriptorGeneration = materials->getGeneration();
             return set;
         };
 
+        // rewrite descriptor set, when material buffer was reallocated
+        virtual void republishDescriptorSet() 
+        {   // 
+            if (created && descriptorGeneration != materials->getGeneration()) { this->makeDescriptorSet(descriptorInfo); };
+        };
+
         //
         virtual void copyCommand(VkCommandBuffer commandBuffer) override 
         {   // 
             materials->copyFromVector(info.materials);
+            this->republishDescriptorSet();
             materials->cmdCopyFromCpu(commandBuffer);
         };
 
+        // 
+        virtual void enqueueUpload(vkh::uni_ptr<TransferBatch> batch) override 
+        {   // 
+            materials->copyFromVector(info.materials);
+            this->republishDescriptorSet();
+            batch->pushDataSet(materials);
+        };
+
+        //
+        virtual void selectStaging(uint32_t frameIndex) override
+        {   // 
+            materials->selectStaging(frameIndex);
+        };
+
+        //
+        virtual void setRecordingFrame(uint64_t frame) override
+        {   // 
+            this->recordingFrame = frame;
+            materials->setRecordingFrame(frame);
+        };
+
+        //
+        virtual void releaseRetired(uint64_t completedFrame) override
+        {   // 
+            materials->releaseRetired(completedFrame);
+        };
+
         //
         virtual uintptr_t pushTexture(vkh::VkDescriptorImageInfo texture) 
         {   
@@ -180,6 +229,7 @@ namespace icv {
         {   
             uintptr_t index = this->info.materials.size();
             this->info.materials.push_back(material);
+            this->materials->markDirty(index);
             return index;
         };
 
@@ -187,6 +237,7 @@ namespace icv {
         void setMaterial(uintptr_t index, vkh::uni_arg<M> material) {
             if (info.materials.size() <= index) { info.materials.resize(index+1u); };
             info.materials[index] = material;
+            materials->markDirty(index);
         };
 
     };
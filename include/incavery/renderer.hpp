@@ -13,6 +13,9 @@
 #include "./pipelineLayout.hpp"
 #include "./graphicsPipeline.hpp"
 #include "./computePipeline.hpp"
+#include "./asyncTransfer.hpp"
+#include "./accelerationCache.hpp"
+#include "./sceneGraph.hpp"
 
 // 
 namespace icv {
@@ -23,29 +26,48 @@ namespace icv {
         vkh::uni_ptr<Framebuffer> framebuffer = {};
         vkh::uni_ptr<InstanceLevel> instanceLevel = {};
         vkh::uni_ptr<DrawInstanceLevel> drawInstanceLevel = {};
+        vkh::uni_ptr<SceneGraph> sceneGraph = {}; // writes world transforms into levels, before uploads
 
         // reserved for future usage (currently are descriptor set sources)
         vkh::uni_ptr<GeometryRegistry> geometryRegistry = {};
         vkh::uni_ptr<MaterialSetBase> materialSet = {};
 
+        // streamed uploads, consumed by rendering command
+        vkh::uni_ptr<AsyncTransfer> asyncTransfer = {};
+
+        // scratch limit of one batched build of geometry levels, and shared scratch (created when not set)
+        VkDeviceSize buildScratchBudget = 64ull * 1024ull * 1024ull;
+        vkh::uni_ptr<ScratchArena> scratchArena = {};
+
         // needs for some related operations
         std::vector<vkh::uni_ptr<GeometryLevel>> geometryLevels = {};
+        bool deduplicateGeometry = false; // identical levels pushed once, instanced by same geometry id (opt-in, later edits of shared level affect every user)
 
         // pipelines
         vkh::uni_ptr<ComputePipeline> indirectCompute = {};
         std::vector<vkh::uni_ptr<GraphicsPipeline>> pipelines = {};
         vkh::uni_ptr<ComputePipeline> rayTraceCompute = {};
+        vkh::uni_ptr<ComputePipeline> nativeInstanceCompute = {}; // for instance level with native instances on device
     };
 
     // 
     class Renderer: public DeviceBased {
         protected:
         RendererInfo info = {};
+        std::vector<uint64_t> geometryGenerations = {};
+        std::unordered_map<uint64_t, uintptr_t> geometryIndices = {};
+        bool nativeComputeWarned = false;
+
+        // batches of enqueueUploads, reset when their frame is completed
+        std::vector<Retired<vkh::uni_ptr<TransferBatch>>> pendingBatches = {};
 
         // 
         virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<RendererInfo> info = RendererInfo{}) {
             this->device = device;
             this->info = info;
+            if (!this->info.scratchArena.has()) {
+                this->info.scratchArena = std::make_shared<ScratchArena>(device);
+            };
         };
 
         // 
@@ -59,6 +81,11 @@ namespace icv {
             this->info.rayTraceCompute = computePipeline;
         };
 
+        //
+        virtual void changeNativeInstanceComputePipeline(vkh::uni_ptr<ComputePipeline> computePipeline = {}) {
+            this->info.nativeInstanceCompute = computePipeline;
+        };
+
         //
         virtual void changeIndirectComputePipeline(vkh::uni_ptr<ComputePipeline> computePipeline = {}) {
             this->info.indirectCompute = computePipeline;
@@ -75,11 +102,34 @@ namespace icv {
         //
         virtual uintptr_t pushGeometryLevel(vkh::uni_ptr<GeometryLevel> info = {})
         {   // add instance into registry
+            // empty levels are usually filled after push, so never shared
+            const bool shareable = this->info.deduplicateGeometry && info.has() && info->getInfo().geometries.size() > 0ull;
+            if (shareable) {
+                const intptr_t found = this->findGeometryLevel(info);
+                if (found >= 0) { return uintptr_t(found); };
+            };
+
+            //
             uintptr_t geometryId = this->info.geometryLevels.size();
             this->info.geometryLevels.push_back(info);
+            if (shareable) { this->geometryIndices[info->getGeometryHash()] = geometryId; };
             return geometryId;
         };
 
+        // level with identical geometry, or -1 (rechecked field-wise, because levels may be changed after push and hashes may collide)
+        virtual intptr_t findGeometryLevel(vkh::uni_ptr<GeometryLevel> geometryLevel)
+        {
+            const uint64_t hash = geometryLevel->getGeometryHash();
+            auto found = geometryIndices.find(hash);
+            if (found == geometryIndices.end() || found->second >= this->info.geometryLevels.size()) { return -1; };
+
+            //
+            auto& existing = this->info.geometryLevels[found->second];
+            if (!existing.has() || existing->getInfo().geometries.size() <= 0ull || existing->getGeometryHash() != hash) { this->geometryIndices.erase(found); return -1; };
+            if (!existing->isSameGeometry(geometryLevel)) { return -1; };
+            return intptr_t(found->second);
+        };
+
 
 
         //
@@ -111,14 +161,291 @@ namespace icv {
             this->info.materialSet = materialSet;
         };
 
+        //
+        virtual void setAsyncTransfer(vkh::uni_ptr<AsyncTransfer> asyncTransfer) 
+        {
+            this->info.asyncTransfer = asyncTransfer;
+        };
+
+        // for submit of rendering command, only when async uploads are pending
+        virtual AsyncTransferWait getAsyncTransferWait() 
+        {
+            return info.asyncTransfer.has() ? info.asyncTransfer->takeWait() : AsyncTransferWait{};
+        };
+
+        // use staging slices of frame in flight, for every level
+        virtual void selectStaging(uint32_t frameIndex) 
+        {
+            if (this->info.materialSet.has()) { this->info.materialSet->selectStaging(frameIndex); };
+            if (this->info.geometryRegistry.has()) { this->info.geometryRegistry->selectStaging(frameIndex); };
+            if (this->info.instanceLevel.has()) { this->info.instanceLevel->selectStaging(frameIndex); };
+            if (this->info.instanceLevel.has()) { for (auto& layer : this->info.instanceLevel->getLayers()) { if (layer.has()) { layer->selectStaging(frameIndex); }; }; };
+            if (this->info.drawInstanceLevel.has()) { this->info.drawInstanceLevel->selectStaging(frameIndex); };
+            for (auto& geometryLevel : this->info.geometryLevels) {
+                if (geometryLevel.has()) { geometryLevel->selectStaging(frameIndex); };
+            };
+        };
+
+        // uploads of every level into one batch (one per frame in flight, reset by releaseRetired)
+        virtual void enqueueUploads(vkh::uni_ptr<TransferBatch> batch) 
+        {
+            this->pendingBatches.push_back(Retired<vkh::uni_ptr<TransferBatch>>{ batch, recordingFrame });
+            if (this->info.sceneGraph.has()) { this->info.sceneGraph->update(); };
+            if (this->info.materialSet.has()) { this->info.materialSet->enqueueUpload(batch); };
+            if (this->info.geometryRegistry.has()) { this->info.geometryRegistry->enqueueUpload(batch); };
+            for (auto& geometryLevel : this->info.geometryLevels) {
+                if (geometryLevel.has()) { geometryLevel->enqueueUpload(batch); };
+            };
+            if (this->info.instanceLevel.has()) { for (auto& layer : this->info.instanceLevel->getLayers()) { if (layer.has()) { layer->enqueueUpload(batch, this->generatesNativeInstances(layer)); }; }; };
+            if (this->info.instanceLevel.has()) { this->info.instanceLevel->enqueueUpload(batch, this->generatesNativeInstances(this->info.instanceLevel)); };
+            if (this->info.drawInstanceLevel.has()) { this->info.drawInstanceLevel->enqueueUpload(batch); };
+        };
+
         // 
         virtual void setGeometryReferences() 
         {
-            this->info.drawInstanceLevel->setGeometryReferences(this->info.geometryLevels);
-            this->info.instanceLevel->setGeometryReferences(this->info.geometryLevels);
+            if (this->info.drawInstanceLevel.has()) { this->info.drawInstanceLevel->setGeometryReferences(this->info.geometryLevels); };
+            if (this->info.instanceLevel.has()) { this->info.instanceLevel->setGeometryReferences(this->info.geometryLevels); };
+            if (this->info.instanceLevel.has()) { for (auto& layer : this->info.instanceLevel->getLayers()) { if (layer.has()) { layer->setGeometryReferences(this->info.geometryLevels); }; }; };
+        };
+
+        // re-accept geometry levels, when any was grown or re-made since last call
+        virtual bool refreshGeometryReferences() 
+        {
+            bool changed = geometryGenerations.size() != this->info.geometryLevels.size();
+            geometryGenerations.resize(this->info.geometryLevels.size());
+            for (uintptr_t i = 0; i < this->info.geometryLevels.size(); i++) {
+                auto& geometryLevel = this->info.geometryLevels[i];
+                if (!geometryLevel.has()) { continue; };
+                if (geometryLevel->isAccelerationStale() || geometryGenerations[i] != geometryLevel->getGeneration()) { changed = true; };
+            };
+            if (!changed) { return false; };
+
+            // 
+            this->setGeometryReferences();
+            for (uintptr_t i = 0; i < this->info.geometryLevels.size(); i++) {
+                if (this->info.geometryLevels[i].has()) { geometryGenerations[i] = this->info.geometryLevels[i]->getGeneration(); };
+            };
+            return true;
         };
 
 
+        // every dirty geometry level, in fewest build commands (before top level build)
+        virtual bool buildGeometryLevels(VkCommandBuffer commandBuffer) 
+        {
+            const VkDeviceSize scratchAlignment = 256ull;
+
+            // 
+            std::vector<vkh::uni_ptr<GeometryLevel>> levels = {};
+            for (auto& geometryLevel : this->info.geometryLevels) {
+                if (geometryLevel.has()) { geometryLevel->remapAddresses(); geometryLevel->remapBindings(); geometryLevel->advanceFrame(); };
+                if (geometryLevel.has() && geometryLevel->isDirty() && geometryLevel->getInfo().geometries.size() > 0ull) { levels.push_back(geometryLevel); };
+            };
+            if (levels.size() <= 0ull) { return false; };
+
+            // geometry tables, before any build reads transforms
+            for (auto& level : levels) { level->uploadCommand(commandBuffer); };
+            {
+                VkMemoryBarrier memoryBarrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .pNext = nullptr,
+                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+                };
+                device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+            };
+
+            // build or refit mode decides scratch size
+            for (auto& level : levels) { level->prepareBuild(); };
+
+            // indirect levels build one by one, ranges are known only on device
+            std::vector<vkh::uni_ptr<GeometryLevel>> indirectLevels = {};
+            for (auto& level : levels) { if (level->isIndirectBuild()) { indirectLevels.push_back(level); }; };
+            for (auto& level : indirectLevels) {
+                info.scratchArena->reserve(level->getScratchSize());
+                info.scratchArena->cmdReuseBarrier(commandBuffer);
+                level->setScratchData(info.scratchArena->acquire(level->getScratchSize()));
+                level->buildIndirectCommand(commandBuffer);
+            };
+            if (indirectLevels.size() > 0ull) {
+                info.scratchArena->cmdReuseBarrier(commandBuffer);
+                std::vector<vkh::uni_ptr<GeometryLevel>> batched = {};
+                for (auto& level : levels) { if (!level->isIndirectBuild()) { batched.push_back(level); }; };
+                for (auto& level : indirectLevels) { level->markBuilt(); level->queryCompactedSizeCommand(commandBuffer); };
+                levels = batched;
+                if (levels.size() <= 0ull) { this->refreshGeometryReferences(); return true; };
+            };
+
+            // split by scratch budget, single level over budget is own batch
+            std::vector<uintptr_t> batchEnds = {};
+            VkDeviceSize batchScratch = 0ull, maxScratch = 0ull;
+            for (uintptr_t i = 0; i < levels.size(); i++) {
+                const VkDeviceSize scratchSize = ((levels[i]->getScratchSize() + scratchAlignment - 1ull) / scratchAlignment) * scratchAlignment;
+                if (batchScratch > 0ull && (batchScratch + scratchSize) > info.buildScratchBudget) {
+                    batchEnds.push_back(i);
+                    batchScratch = 0ull;
+                };
+                batchScratch += scratchSize;
+                maxScratch = std::max(maxScratch, batchScratch);
+            };
+            batchEnds.push_back(levels.size());
+
+            // slices reused by every batch, and after previous builds in same command
+            info.scratchArena->reserve(maxScratch);
+            info.scratchArena->cmdReuseBarrier(commandBuffer);
+
+            // 
+            uintptr_t first = 0ull;
+            for (auto& last : batchEnds) {
+                std::vector<VkAccelerationStructureBuildGeometryInfoKHR> infos = {};
+                std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> ranges = {};
+
+                info.scratchArena->reset();
+                for (uintptr_t i = first; i < last; i++) {
+                    auto& level = levels[i];
+                    level->setScratchData(info.scratchArena->acquire(level->getScratchSize()));
+
+                    // 
+                    auto& buildInfo = level->getBuildInfo();
+                    infos.push_back(reinterpret_cast<const VkAccelerationStructureBuildGeometryInfoKHR&>(buildInfo.info));
+                    ranges.push_back(reinterpret_cast<const VkAccelerationStructureBuildRangeInfoKHR*>(buildInfo.ranges.data()));
+                };
+                device->dispatch->CmdBuildAccelerationStructuresKHR(commandBuffer, uint32_t(infos.size()), infos.data(), ranges.data());
+
+                // scratch reused by next batch, last one protects top level build instead
+                VkMemoryBarrier memoryBarrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .pNext = nullptr,
+                    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
+                };
+                device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+                first = last;
+            };
+
+            // compacted sizes, read back by compactGeometryLevels after this submit
+            for (auto& level : levels) { 
+                level->markBuilt(); 
+                level->queryCompactedSizeCommand(commandBuffer);
+            };
+            this->refreshGeometryReferences();
+            return true;
+        };
+
+        // layers which are changed, then own (every layer has own scratch reuse barrier)
+        virtual void buildInstanceLevel(VkCommandBuffer commandBuffer) 
+        {
+            if (!info.instanceLevel.has()) { return; };
+            if (info.sceneGraph.has()) { info.sceneGraph->update(); }; // when not uploaded by batch
+            info.instanceLevel->republishDescriptorSet(); // layer instance buffers, read by native instance generation
+            auto& layers = info.instanceLevel->getLayers();
+            info.instanceLevel->advanceFrame();
+            for (auto& layer : layers) { if (layer.has()) { layer->advanceFrame(); }; };
+            for (uint32_t i = 0u; i < layers.size(); i++) {
+                if (layers[i].has() && layers[i]->isDirty()) { this->buildInstanceLayer(commandBuffer, layers[i], i + 1u); };
+            };
+            this->buildInstanceLayer(commandBuffer, info.instanceLevel, 0u);
+            info.instanceLevel->republishDescriptorSet();
+        };
+
+        // by compute of renderer when level enabled it, otherwise packed by CPU
+        virtual bool generatesNativeInstances(vkh::uni_ptr<InstanceLevel> instanceLevel) const 
+        {
+            return instanceLevel->usesDeviceNativeInstances() && info.nativeInstanceCompute.has();
+        };
+
+        // upload, native instances generated on device when enabled, then build (or refit)
+        virtual void buildInstanceLayer(VkCommandBuffer commandBuffer, vkh::uni_ptr<InstanceLevel> instanceLevel, uint32_t layerId = 0u) 
+        {
+            if (!this->generatesNativeInstances(instanceLevel)) {
+                if (instanceLevel->usesDeviceNativeInstances() && !nativeComputeWarned) { std::cerr << "Native instance compute not defined, instances packed by CPU" << std::endl; this->nativeComputeWarned = true; };
+                instanceLevel->buildCommand(commandBuffer);
+                return;
+            };
+
+            //
+            const uint32_t LOCAL_GROUP_X = 128u;
+            const uint32_t count = uint32_t(instanceLevel->getInfo().instances.size());
+            instanceLevel->uploadCommand(commandBuffer, true);
+            vkt::commandBarrier(device->dispatch, commandBuffer);
+            info.nativeInstanceCompute->createComputeCommand(commandBuffer, glm::uvec3((count + LOCAL_GROUP_X - 1u) / LOCAL_GROUP_X, 1u, 1u), instanceLevel->getNativeConstants(layerId));
+
+            //
+            VkMemoryBarrier memoryBarrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT
+            };
+            device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+            instanceLevel->buildAccelerationCommand(commandBuffer);
+        };
+
+        // levels which results of compacted size query are ready (originals released by releaseRetired)
+        virtual bool compactGeometryLevels(VkCommandBuffer commandBuffer) 
+        {
+            bool compacted = false;
+            for (auto& geometryLevel : this->info.geometryLevels) {
+                if (geometryLevel.has() && geometryLevel->isCompactionPending()) { compacted |= geometryLevel->compactCommand(commandBuffer); };
+            };
+            if (!compacted) { return false; };
+
+            // 
+            VkMemoryBarrier memoryBarrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+            };
+            device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+            this->refreshGeometryReferences();
+            return true;
+        };
+
+        // frame (or timeline value) of next recorded commands, for every level (before uploads and builds of that frame)
+        virtual void setRecordingFrame(uint64_t frame) override
+        {
+            this->recordingFrame = frame;
+            for (auto& geometryLevel : this->info.geometryLevels) {
+                if (geometryLevel.has()) { geometryLevel->setRecordingFrame(frame); };
+            };
+            if (this->info.instanceLevel.has()) { this->info.instanceLevel->setRecordingFrame(frame); };
+            if (this->info.instanceLevel.has()) { for (auto& layer : this->info.instanceLevel->getLayers()) { if (layer.has()) { layer->setRecordingFrame(frame); }; }; };
+            if (this->info.drawInstanceLevel.has()) { this->info.drawInstanceLevel->setRecordingFrame(frame); };
+            if (this->info.scratchArena.has()) { this->info.scratchArena->setRecordingFrame(frame); };
+            if (this->info.geometryRegistry.has()) { this->info.geometryRegistry->setRecordingFrame(frame); };
+            if (this->info.materialSet.has()) { this->info.materialSet->setRecordingFrame(frame); };
+        };
+
+        // resources retired by frames up to completed one (e.g. after wait of oldest frame in flight), later are kept
+        virtual void releaseRetired(uint64_t completedFrame) 
+        {
+            for (auto& geometryLevel : this->info.geometryLevels) {
+                if (geometryLevel.has()) { geometryLevel->releaseRetired(completedFrame); };
+            };
+            if (this->info.instanceLevel.has()) { this->info.instanceLevel->releaseRetired(completedFrame); };
+            if (this->info.instanceLevel.has()) { for (auto& layer : this->info.instanceLevel->getLayers()) { if (layer.has()) { layer->releaseRetired(completedFrame); }; }; };
+            if (this->info.drawInstanceLevel.has()) { this->info.drawInstanceLevel->releaseRetired(completedFrame); };
+            if (this->info.scratchArena.has()) { this->info.scratchArena->releaseRetired(completedFrame); };
+            if (this->info.geometryRegistry.has()) { this->info.geometryRegistry->releaseRetired(completedFrame); };
+            if (this->info.materialSet.has()) { this->info.materialSet->releaseRetired(completedFrame); };
+
+            // batch reused by later frame still pending is kept
+            std::vector<vkh::uni_ptr<TransferBatch>> completed = {};
+            releaseCompleted(pendingBatches, completedFrame, [&completed](vkh::uni_ptr<TransferBatch>& batch) { completed.push_back(batch); });
+            for (auto& batch : completed) {
+                bool pending = false;
+                for (auto& later : pendingBatches) { pending |= later.value.get_shared() == batch.get_shared(); };
+                if (!pending) { batch->reset(); };
+            };
+        };
+
+        // when frame, which recorded compactGeometryLevels, is completed
+        virtual void releaseCompactedOriginals(uint64_t completedFrame) 
+        {
+            this->releaseRetired(completedFrame);
+        };
+
         //
         virtual void createRenderingCommand(VkCommandBuffer commandBuffer) 
         {
@@ -126,6 +453,16 @@ namespace icv {
             auto indexedf = vkh::VkDescriptorBindingFlags{ .eUpdateAfterBind = 1, .eUpdateUnusedWhilePending = 1, .ePartiallyBound = 1 };
             auto dflags = vkh::VkDescriptorSetLayoutCreateFlags{ .eUpdateAfterBindPool = 1 };
 
+            // ownership of streamed data (submit should wait getAsyncTransferWait)
+            if (info.asyncTransfer.has()) {
+                info.asyncTransfer->cmdAcquire(commandBuffer);
+            };
+
+            // count of traced layers
+            if (info.instanceLevel.has()) {
+                info.instanceLevel->layerInfoCommand(commandBuffer);
+            };
+
             // clear framebuffers
             auto& framebuffer = info.framebuffer->getState();
             {
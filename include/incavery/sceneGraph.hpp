@@ -0,0 +1,312 @@
+#pragma once
+
+//
+#include "./core.hpp"
+#include "./instanceLevel.hpp"
+#include "./drawInstanceLevel.hpp"
+#include <algorithm>
+
+//
+namespace icv {
+
+    //
+    constexpr uint32_t invalidSceneNode = ~0u;
+
+    //
+    struct SceneGraphInfo
+    {
+        // world transforms are written into bound instances of these levels
+        vkh::uni_ptr<InstanceLevel> instanceLevel = {};
+        vkh::uni_ptr<DrawInstanceLevel> drawInstanceLevel = {};
+        uint32_t maxNodeCount = 1024u; // initial capacity, grows when exceeded
+    };
+
+    // hierarchy of transforms, only changed subtrees recomputed by update (CPU only)
+    class SceneGraph {
+        protected:
+        SceneGraphInfo info = {};
+
+        // per node, SoA (walked per attribute)
+        std::vector<glm::mat3x4> locals = {};
+        std::vector<glm::mat3x4> worlds = {};
+        std::vector<uint32_t> parents = {};
+        std::vector<uint32_t> firstChilds = {};
+        std::vector<uint32_t> nextSiblings = {};
+        std::vector<uint32_t> instanceIds = {};
+        std::vector<uint32_t> drawInstanceIds = {};
+        std::vector<uint8_t> dirty = {}; // local (or binding) changed, subtree should be recomputed
+        std::vector<uint8_t> alive = {};
+
+        // changed since last update, instead of full scan
+        std::vector<uint32_t> dirtyNodes = {};
+        std::vector<uint32_t> freeNodes = {};
+
+        // reused by every update
+        std::vector<uint32_t> stack = {};
+        std::vector<uint32_t> changedInstances = {};
+        std::vector<uint32_t> changedDrawInstances = {};
+
+        //
+        virtual void constructor(vkh::uni_arg<SceneGraphInfo> info = SceneGraphInfo{})
+        {
+            this->info = info;
+            this->reserve(this->info.maxNodeCount);
+        };
+
+        //
+        virtual void markNode(uint32_t nodeId)
+        {
+            if (dirty[nodeId]) { return; };
+            this->dirty[nodeId] = 1u;
+            this->dirtyNodes.push_back(nodeId);
+        };
+
+        //
+        virtual void link(uint32_t nodeId, uint32_t parentId)
+        {
+            this->parents[nodeId] = parentId;
+            if (parentId == invalidSceneNode) { return; };
+            this->nextSiblings[nodeId] = firstChilds[parentId];
+            this->firstChilds[parentId] = nodeId;
+        };
+
+        //
+        virtual void unlink(uint32_t nodeId)
+        {
+            const uint32_t parentId = parents[nodeId];
+            if (parentId != invalidSceneNode) {
+                uint32_t* next = &firstChilds[parentId];
+                while (*next != invalidSceneNode && *next != nodeId) { next = &nextSiblings[*next]; };
+                if (*next == nodeId) { *next = nextSiblings[nodeId]; };
+            };
+            this->parents[nodeId] = invalidSceneNode;
+            this->nextSiblings[nodeId] = invalidSceneNode;
+        };
+
+        // some ancestor is dirty, so will be recomputed with its subtree
+        virtual bool hasDirtyAncestor(uint32_t nodeId) const
+        {
+            for (uint32_t parentId = parents[nodeId]; parentId != invalidSceneNode; parentId = parents[parentId]) {
+                if (dirty[parentId]) { return true; };
+            };
+            return false;
+        };
+
+        // sorted indices into ranges of level
+        template<class L>
+        static void markRanges(vkh::uni_ptr<L> level, std::vector<uint32_t>& indices)
+        {
+            if (!level.has() || indices.empty()) { return; };
+            std::sort(indices.begin(), indices.end());
+            uintptr_t offset = indices[0u], count = 1ull;
+            for (uintptr_t i = 1u; i < indices.size(); i++) {
+                if (indices[i] == (offset + count - 1ull)) { continue; };
+                if (indices[i] == (offset + count)) { count++; continue; };
+                level->markDirty(offset, count);
+                offset = indices[i], count = 1ull;
+            };
+            level->markDirty(offset, count);
+            indices.resize(0u);
+        };
+
+        public:
+        SceneGraph() {};
+        SceneGraph(vkh::uni_arg<SceneGraphInfo> info) { this->constructor(info); };
+
+        // affine composition, rows of mat3x4 (same as shaders)
+        static glm::mat3x4 combine(const glm::mat3x4& parent, const glm::mat3x4& local)
+        {
+            glm::mat3x4 world = {};
+            for (uint32_t i = 0u; i < 3u; i++) {
+                world[i] = parent[i].x * local[0u] + parent[i].y * local[1u] + parent[i].z * local[2u] + glm::vec4(0.f, 0.f, 0.f, parent[i].w);
+            };
+            return world;
+        };
+
+        //
+        virtual void reserve(uintptr_t count)
+        {
+            this->locals.reserve(count);
+            this->worlds.reserve(count);
+            this->parents.reserve(count);
+            this->firstChilds.reserve(count);
+            this->nextSiblings.reserve(count);
+            this->instanceIds.reserve(count);
+            this->drawInstanceIds.reserve(count);
+            this->dirty.reserve(count);
+            this->alive.reserve(count);
+        };
+
+        // under parent, or root
+        virtual uint32_t createNode(uint32_t parentId = invalidSceneNode, const glm::mat3x4& local = glm::mat3x4(1.f))
+        {
+            if (parentId != invalidSceneNode && !this->isValid(parentId)) { std::cerr << "Scene node parent is not valid" << std::endl; parentId = invalidSceneNode; };
+
+            uint32_t nodeId = uint32_t(locals.size());
+            if (freeNodes.size() > 0u) {
+                nodeId = freeNodes.back(); freeNodes.pop_back();
+            } else {
+                this->locals.push_back(glm::mat3x4(1.f));
+                this->worlds.push_back(glm::mat3x4(1.f));
+                this->parents.push_back(invalidSceneNode);
+                this->firstChilds.push_back(invalidSceneNode);
+                this->nextSiblings.push_back(invalidSceneNode);
+                this->instanceIds.push_back(invalidSceneNode);
+                this->drawInstanceIds.push_back(invalidSceneNode);
+                this->dirty.push_back(0u);
+                this->alive.push_back(0u);
+            };
+
+            //
+            this->locals[nodeId] = local;
+            this->worlds[nodeId] = local;
+            this->firstChilds[nodeId] = invalidSceneNode;
+            this->nextSiblings[nodeId] = invalidSceneNode;
+            this->instanceIds[nodeId] = invalidSceneNode;
+            this->drawInstanceIds[nodeId] = invalidSceneNode;
+            this->alive[nodeId] = 1u;
+            this->link(nodeId, parentId);
+            this->markNode(nodeId);
+            return nodeId;
+        };
+
+        // with subtree (bound instances are kept in levels, with last transforms)
+        virtual void removeNode(uint32_t nodeId)
+        {
+            if (!this->isValid(nodeId)) { return; };
+            this->unlink(nodeId);
+
+            //
+            stack.resize(0u);
+            stack.push_back(nodeId);
+            while (stack.size() > 0u) {
+                const uint32_t id = stack.back(); stack.pop_back();
+                for (uint32_t childId = firstChilds[id]; childId != invalidSceneNode; childId = nextSiblings[childId]) { stack.push_back(childId); };
+                this->alive[id] = 0u;
+                this->dirty[id] = 0u;
+                this->parents[id] = invalidSceneNode;
+                this->firstChilds[id] = invalidSceneNode;
+                this->nextSiblings[id] = invalidSceneNode;
+                this->freeNodes.push_back(id);
+            };
+
+            // removed nodes may be reused before update
+            this->dirtyNodes.erase(std::remove_if(dirtyNodes.begin(), dirtyNodes.end(), [this](uint32_t id) { return !dirty[id]; }), dirtyNodes.end());
+        };
+
+        // with subtree, moved under other parent (or made root)
+        virtual void setParent(uint32_t nodeId, uint32_t parentId = invalidSceneNode)
+        {
+            if (!this->isValid(nodeId)) { return; };
+            if (parentId != invalidSceneNode) {
+                if (!this->isValid(parentId)) { std::cerr << "Scene node parent is not valid" << std::endl; return; };
+                for (uint32_t id = parentId; id != invalidSceneNode; id = parents[id]) {
+                    if (id == nodeId) { std::cerr << "Scene node can't be parented into own subtree" << std::endl; return; };
+                };
+            };
+            this->unlink(nodeId);
+            this->link(nodeId, parentId);
+            this->markNode(nodeId);
+        };
+
+        //
+        virtual void setLocal(uint32_t nodeId, const glm::mat3x4& local)
+        {
+            this->locals[nodeId] = local;
+            this->markNode(nodeId);
+        };
+
+        // world transform of node written into instance (one per node, children for more)
+        virtual void bindInstance(uint32_t nodeId, uint32_t instanceId = invalidSceneNode)
+        {
+            this->instanceIds[nodeId] = instanceId;
+            this->markNode(nodeId);
+        };
+
+        //
+        virtual void bindDrawInstance(uint32_t nodeId, uint32_t drawInstanceId = invalidSceneNode)
+        {
+            this->drawInstanceIds[nodeId] = drawInstanceId;
+            this->markNode(nodeId);
+        };
+
+        // recompute changed subtrees, and write into bound instances (returns count of recomputed nodes)
+        virtual uintptr_t update()
+        {
+            uintptr_t updated = 0ull;
+            for (const uint32_t rootId : dirtyNodes) {
+                if (!dirty[rootId] || this->hasDirtyAncestor(rootId)) { continue; };
+
+                //
+                stack.resize(0u);
+                stack.push_back(rootId);
+                while (stack.size() > 0u) {
+                    const uint32_t id = stack.back(); stack.pop_back();
+                    const uint32_t parentId = parents[id];
+                    this->worlds[id] = parentId != invalidSceneNode ? combine(worlds[parentId], locals[id]) : locals[id];
+                    this->dirty[id] = 0u;
+                    updated++;
+
+                    //
+                    if (instanceIds[id] != invalidSceneNode && info.instanceLevel.has() && info.instanceLevel->writeTransform(instanceIds[id], worlds[id])) {
+                        this->changedInstances.push_back(instanceIds[id]);
+                    };
+                    if (drawInstanceIds[id] != invalidSceneNode && info.drawInstanceLevel.has() && info.drawInstanceLevel->writeTransform(drawInstanceIds[id], worlds[id])) {
+                        this->changedDrawInstances.push_back(drawInstanceIds[id]);
+                    };
+
+                    //
+                    for (uint32_t childId = firstChilds[id]; childId != invalidSceneNode; childId = nextSiblings[childId]) { stack.push_back(childId); };
+                };
+            };
+
+            //
+            for (const uint32_t id : dirtyNodes) { this->dirty[id] = 0u; };
+            this->dirtyNodes.resize(0u);
+            markRanges(info.instanceLevel, changedInstances);
+            markRanges(info.drawInstanceLevel, changedDrawInstances);
+            return updated;
+        };
+
+        //
+        virtual bool isValid(uint32_t nodeId) const {
+            return nodeId < alive.size() && alive[nodeId];
+        };
+
+        //
+        virtual bool isDirty() const {
+            return dirtyNodes.size() > 0u;
+        };
+
+        //
+        virtual uint32_t getParent(uint32_t nodeId) const {
+            return parents[nodeId];
+        };
+
+        //
+        virtual const glm::mat3x4& getLocal(uint32_t nodeId) const {
+            return locals[nodeId];
+        };
+
+        // valid after update
+        virtual const glm::mat3x4& getWorld(uint32_t nodeId) const {
+            return worlds[nodeId];
+        };
+
+        // including removed (reused by next created)
+        virtual uintptr_t getNodeCount() const {
+            return locals.size();
+        };
+
+        //
+        virtual const SceneGraphInfo& getInfo() const {
+            return info;
+        };
+
+        //
+        virtual SceneGraphInfo& getInfo() {
+            return info;
+        };
+    };
+
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+//
+#include "./core.hpp"
+
+//
+namespace icv {
+
+    //
+    struct ScratchArenaInfo
+    {
+        VkDeviceSize size = 16ull * 1024ull * 1024ull; // initial, grows when exceeded
+        VkDeviceSize alignment = 256ull; // minAccelerationStructureScratchOffsetAlignment
+    };
+
+    // transient scratch for acceleration structure builds, shared by levels and reused across frames
+    class ScratchArena: public DeviceBased {
+        protected:
+        ScratchArenaInfo info = {};
+        vkf::VectorBase buffer = {};
+        VkDeviceSize capacity = 0ull;
+        VkDeviceSize offset = 0ull;
+
+        // replaced by growth, may be still used by previous builds (released by releaseRetired)
+        std::vector<Retired<vkf::VectorBase>> retired = {};
+
+        //
+        virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<ScratchArenaInfo> info = ScratchArenaInfo{})
+        {
+            this->info = info;
+            this->device = device;
+            this->reserve(info->size);
+        };
+
+        //
+        virtual VkDeviceSize alignUp(VkDeviceSize size) const {
+            return ((size + info.alignment - 1ull) / info.alignment) * info.alignment;
+        };
+
+        public:
+        ScratchArena() {};
+        ScratchArena(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<ScratchArenaInfo> info = ScratchArenaInfo{}) { this->constructor(device, info); };
+
+        // slices of next batch will fit, without growth
+        virtual void reserve(VkDeviceSize size)
+        {
+            if (size <= capacity) { return; };
+            if (buffer.range() > 0ull) { this->retired.push_back(Retired<vkf::VectorBase>{ this->buffer, recordingFrame }); };
+            this->capacity = std::max(this->alignUp(size), capacity * VkDeviceSize(2u));
+            this->buffer = createBuffer(BufferCreateInfo{.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, .size = capacity + info.alignment});
+            this->offset = 0ull;
+        };
+
+        // slice of current batch
+        virtual VkDeviceAddress acquire(VkDeviceSize size)
+        {
+            size = this->alignUp(size);
+            if ((offset + size) > capacity) { this->reserve(offset + size); this->offset = 0ull; };
+
+            //
+            const VkDeviceAddress base = this->alignUp(buffer.deviceAddress());
+            const VkDeviceAddress address = base + offset;
+            this->offset += size;
+            return address;
+        };
+
+        // next batch reuses slices, after previous builds are done with them
+        virtual void reset() {
+            this->offset = 0ull;
+        };
+
+        // replaced by frames up to completed one, which builds used them
+        virtual void releaseRetired(uint64_t completedFrame) {
+            releaseCompleted(retired, completedFrame, [](vkf::VectorBase&) {});
+        };
+
+        // for single builds, which reuse from start within same command buffer
+        virtual void cmdReuseBarrier(VkCommandBuffer commandBuffer)
+        {
+            VkMemoryBarrier memoryBarrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
+            };
+            device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+            this->reset();
+        };
+    };
+
+};
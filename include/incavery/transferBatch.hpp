@@ -0,0 +1,229 @@
+#pragma once
+
+// 
+#include "./core.hpp"
+#include "./dataSet.hpp"
+
+// 
+namespace icv {
+
+    // 
+    struct TransferBatchInfo 
+    {
+        VkDeviceSize arenaSize = 16ull * 1024ull * 1024ull;
+    };
+
+    // 
+    struct TransferCopy 
+    {
+        VkBuffer srcBuffer = VK_NULL_HANDLE;
+        VkBuffer dstBuffer = VK_NULL_HANDLE;
+        VkBufferCopy2KHR region = {};
+        uint32_t phase = 0u; // ordered after copies of previous phases
+    };
+
+    // collects uploads of every subsystem, and records them with one barrier
+    class TransferBatch: public DeviceBased {
+        protected: 
+        TransferBatchInfo info = {};
+
+        // 
+        std::vector<vkh::uni_ptr<DataSetBase>> dataSets = {};
+        std::vector<TransferCopy> copies = {};
+        uint32_t phase = 0u;
+
+        // buffers read by recorded copies (e.g. relocated arenas), alive until reset
+        std::vector<vkf::VectorBase> retained = {};
+
+        // staging arena, older blocks alive until reset
+        std::vector<vkf::Vector<uint8_t>> arenas = {};
+        VkDeviceSize arenaOffset = 0ull;
+
+        // 
+        virtual void constructor(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<TransferBatchInfo> info = TransferBatchInfo{}) 
+        {
+            this->info = info;
+            this->device = device;
+            this->arenas.push_back(vkf::Vector<uint8_t>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT, .size = info->arenaSize, .stride = sizeof(uint8_t), .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU })));
+        };
+
+        public: 
+        TransferBatch() {};
+        TransferBatch(vkh::uni_ptr<vkf::Device> device, vkh::uni_arg<TransferBatchInfo> info = TransferBatchInfo{}) { this->constructor(device, info); };
+
+        // 
+        virtual void pushDataSet(vkh::uni_ptr<DataSetBase> dataSet) 
+        {
+            this->dataSets.push_back(dataSet);
+        };
+
+        // 
+        template<class T>
+        void pushDataSet(vkh::uni_ptr<DataSet<T>> dataSet) 
+        {
+            this->pushDataSet(vkh::uni_ptr<DataSetBase>(std::static_pointer_cast<DataSetBase>(dataSet.get_shared())));
+        };
+
+        // pack raw data into arena, instead of own staging and submit
+        virtual void pushUpload(vkh::VkDescriptorBufferInfo buffer, const void* data, VkDeviceSize size) 
+        {
+            if (size <= 0ull) { return; };
+            const VkDeviceSize alignment = 16ull;
+            VkDeviceSize offset = (arenaOffset + alignment - 1ull) & ~(alignment - 1ull);
+
+            // grow with new block, previous still used by pending copies
+            if ((offset + size) > arenas.back().range()) {
+                this->arenas.push_back(vkf::Vector<uint8_t>(createBuffer(BufferCreateInfo{ .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT, .size = std::max(size, VkDeviceSize(arenas.back().range() * 2u)), .stride = sizeof(uint8_t), .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU })));
+                offset = 0ull;
+            };
+
+            // 
+            auto& arena = arenas.back();
+            memcpy(&arena[offset], data, size);
+            this->copies.push_back(TransferCopy{
+                .srcBuffer = arena,
+                .dstBuffer = buffer.buffer,
+                .region = VkBufferCopy2KHR{
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2_KHR,
+                    .pNext = nullptr,
+                    .srcOffset = arena.offset() + offset,
+                    .dstOffset = buffer.offset,
+                    .size = size
+                },
+                .phase = phase
+            });
+            this->arenaOffset = offset + size;
+        };
+
+        // device to device, such as relocation of suballocated data (regions should not overlap)
+        virtual void pushCopy(vkh::VkDescriptorBufferInfo src, vkh::VkDescriptorBufferInfo dst) 
+        {
+            if (std::min(src.range, dst.range) <= 0ull) { return; };
+            this->copies.push_back(TransferCopy{
+                .srcBuffer = src.buffer,
+                .dstBuffer = dst.buffer,
+                .region = VkBufferCopy2KHR{
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2_KHR,
+                    .pNext = nullptr,
+                    .srcOffset = src.offset,
+                    .dstOffset = dst.offset,
+                    .size = std::min(src.range, dst.range)
+                },
+                .phase = phase
+            });
+        };
+
+        // next copies read results of previous (e.g. relocation of just uploaded data), so recorded after barrier
+        virtual void nextPhase() 
+        {
+            if (copies.size() > 0ull) { this->phase++; };
+        };
+
+        // kept until recorded copies are completed
+        virtual void retain(vkf::VectorBase buffer) 
+        {
+            this->retained.push_back(buffer);
+        };
+
+        // 
+        virtual bool isEmpty() const 
+        {
+            return dataSets.size() <= 0ull && copies.size() <= 0ull;
+        };
+
+        // destinations of recorded copies, for ownership transfer
+        virtual std::vector<vkh::VkDescriptorBufferInfo> getDestinations() 
+        {
+            std::vector<vkh::VkDescriptorBufferInfo> destinations = {};
+            for (auto& dataSet : dataSets) { destinations.push_back(dataSet->getDestination()); };
+            for (auto& copy : copies) { destinations.push_back(vkh::VkDescriptorBufferInfo{ .buffer = copy.dstBuffer, .offset = copy.region.dstOffset, .range = copy.region.size }); };
+            return destinations;
+        };
+
+        // copies only, with transfer barriers between phases (for queues without graphics stages)
+        virtual void cmdCopies(VkCommandBuffer commandBuffer) 
+        {
+            for (auto& dataSet : dataSets) {
+                dataSet->cmdCopyFromCpu(commandBuffer);
+            };
+
+            // one copy command per buffer pair, within phase
+            std::stable_sort(copies.begin(), copies.end(), [](const TransferCopy& a, const TransferCopy& b) { return a.phase != b.phase ? a.phase < b.phase : (a.srcBuffer != b.srcBuffer ? a.srcBuffer < b.srcBuffer : a.dstBuffer < b.dstBuffer); });
+            for (uintptr_t first = 0ull; first < copies.size();) {
+                if (first > 0ull && copies[first].phase != copies[first - 1ull].phase) {
+                    VkMemoryBarrier memoryBarrier = {
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                        .pNext = nullptr,
+                        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+                    };
+                    device->dispatch->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+                };
+
+                //
+                std::vector<VkBufferCopy2KHR> regions = {};
+                uintptr_t last = first;
+                for (; last < copies.size() && copies[last].phase == copies[first].phase && copies[last].srcBuffer == copies[first].srcBuffer && copies[last].dstBuffer == copies[first].dstBuffer; last++) {
+                    regions.push_back(copies[last].region);
+                };
+
+                VkCopyBufferInfo2KHR copyInfo = {
+                    .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2_KHR,
+                    .pNext = nullptr,
+                    .srcBuffer = copies[first].srcBuffer,
+                    .dstBuffer = copies[first].dstBuffer,
+                    .regionCount = uint32_t(regions.size()),
+                    .pRegions = regions.data()
+                };
+                device->dispatch->CmdCopyBuffer2KHR(commandBuffer, &copyInfo);
+                first = last;
+            };
+        };
+
+        // arena and retained buffers are still read by recorded copies, so reset() is required after completion (done by Renderer::releaseRetired for batches of enqueueUploads)
+        virtual void cmdFlush(VkCommandBuffer commandBuffer) 
+        {
+            if (this->isEmpty()) { return; };
+            this->cmdCopies(commandBuffer);
+
+            // single barrier for every consumer of uploaded data
+            VkMemoryBarrier memoryBarrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+            };
+            device->dispatch->CmdPipelineBarrier(commandBuffer, 
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 
+                VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 
+                0u, 1u, &memoryBarrier, 0u, nullptr, 0u, nullptr);
+
+            // 
+            this->dataSets.resize(0u);
+            this->copies.resize(0u);
+            this->phase = 0u;
+        };
+
+        // when recorded copies are completed
+        virtual void reset() 
+        {
+            this->dataSets.resize(0u);
+            this->copies.resize(0u);
+            this->retained.resize(0u);
+            this->phase = 0u;
+            if (arenas.size() > 1ull) { arenas.erase(arenas.begin(), arenas.end() - 1u); };
+            this->arenaOffset = 0ull;
+        };
+
+        // 
+        virtual void flush(vkh::uni_ptr<vkf::Queue> queue = {}) 
+        {   // 
+            if (this->isEmpty()) { return; };
+            queue->submitOnce([&,this](VkCommandBuffer commandBuffer){
+                this->cmdFlush(commandBuffer);
+            });
+            this->reset();
+        };
+    };
+
+};
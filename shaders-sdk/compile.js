@@ -24,6 +24,7 @@ compileShader("rasterization.vert", "translucent.vert");
 
 compileShader("rayTracing.comp", "rayTracing.comp");
 compileShader("instanced.comp", "instanced.comp");
+compileShader("nativeInstances.comp", "nativeInstances.comp");
 
 compileShader("render.frag", "render.frag");
 compileShader("render.vert", "render.vert");
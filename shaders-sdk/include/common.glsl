@@ -15,7 +15,7 @@ struct RayData
 struct IntersectionInfo 
 {
     vec3 barycentric; float hitT;
-    uint instanceId, geometryId, primitiveId, reserved0;
+    uint instanceId, geometryId, primitiveId, layerId;
 };
 
 vec4 divW(in vec4 pos) {
@@ -37,7 +37,7 @@ struct DrawInstanceInfo
     uint32_t customIndex;
 
     GeometryLevel geometryLevelReference;
-    uint64_t geometryLevelIndirectReference;
+    BuildRangeBuffer geometryLevelIndirectReference;
     DrawIndirectBuffer drawIndirectReference;
     
     uint32_t instanceCount;
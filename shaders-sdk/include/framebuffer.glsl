@@ -31,6 +31,7 @@ IntersectionInfo rasterization(in RayData rays, in float maxT) {
     result.instanceId = indices.x;
     result.geometryId = indices.y;
     result.primitiveId = indices.z;
+    result.layerId = 0u; // draw instances are own layer
     result.hitT = maxT;
 
     // compute hitT from rasterization
@@ -55,6 +55,9 @@ struct GeometryInfo
     Attributes attributes; // REQUIRED for SOME triangles, so we dedicated into that block
 };
 
+// stride of geometry table (checked by static_assert on host side)
+const uint GEOMETRY_INFO_SIZE = 128u;
+
 // 
 //layout (binding = 2, set = INSTANCE_LEVEL_MAP, scalar) buffer GeometryBuffer { GeometryInfo geometries[]; } registry[];
 
@@ -62,6 +65,20 @@ layout(buffer_reference, scalar) buffer GeometryLevel {
     GeometryInfo geometries[];
 };
 
+// same as VkAccelerationStructureBuildRangeInfoKHR, for indirect build
+struct BuildRange 
+{
+    uint32_t primitiveCount;
+    uint32_t primitiveOffset;
+    uint32_t firstVertex;
+    uint32_t transformOffset;
+};
+
+// 
+layout(buffer_reference, scalar) buffer BuildRangeBuffer {
+    BuildRange geometries[];
+};
+
 // 
 struct AttributeMap 
 {
@@ -26,6 +26,19 @@ layout(buffer_reference, scalar, buffer_reference_align = 1) buffer RawDataUint
     uint32_t data[];
 };
 
+// wide loads, only for aligned bindings
+layout(buffer_reference, scalar, buffer_reference_align = 4) buffer RawDataUintAligned {
+    uint32_t data[];
+};
+
+layout(buffer_reference, scalar, buffer_reference_align = 8) buffer RawDataUint2 {
+    uvec2 data[];
+};
+
+layout(buffer_reference, scalar, buffer_reference_align = 16) buffer RawDataUint4 {
+    uvec4 data[];
+};
+
 
 //struct RawData {
 //    uint32_t bufferId;
@@ -90,10 +103,61 @@ vec4 readFloat4(in RawData ptr, in uint byteOffset)
     );
 };
 
-// read binding as float4
+// same as BindingFormat
+const uint BINDING_FORMAT_FLOAT4 = 0u;
+const uint BINDING_FORMAT_HALF4 = 1u;
+const uint BINDING_FORMAT_SNORM16X4 = 2u;
+const uint BINDING_FORMAT_UNORM8X4 = 3u;
+const uint BINDING_FORMAT_OCTAHEDRAL = 4u;
+const uint BINDING_FORMAT_UNORM10X3A2 = 5u;
+const uint BINDING_ALIGNED = 0x10000u;
+const uint BINDING_FORMAT_MASK = 0xFFFFu;
+
+// unit normal
+vec3 decodeOctahedral(in vec2 e) 
+{
+    vec3 n = vec3(e, 1.f - abs(e.x) - abs(e.y));
+    if (n.z < 0.f) { n.xy = (1.f - abs(n.yx)) * mix(vec2(-1.f), vec2(1.f), greaterThanEqual(n.xy, vec2(0.f))); };
+    return normalize(n);
+};
+
+// 
+vec4 unpackUnorm10x3A2(in uint packed) 
+{
+    return vec4(
+        float(bitfieldExtract(packed,  0, 10)) / 1023.f,
+        float(bitfieldExtract(packed, 10, 10)) / 1023.f,
+        float(bitfieldExtract(packed, 20, 10)) / 1023.f,
+        float(bitfieldExtract(packed, 30,  2)) / 3.f
+    );
+};
+
+// one load per element, when validated by registry
+vec4 readBinding4Aligned(in BindingInfo bindingInfo, in uint offset) 
+{
+    const RawData ptr = bindingInfo.ptr + offset;
+    switch (bindingInfo.format & BINDING_FORMAT_MASK) {
+        case BINDING_FORMAT_HALF4: { uvec2 v = RawDataUint2(ptr).data[0u]; return vec4(unpackHalf2x16(v.x), unpackHalf2x16(v.y)); };
+        case BINDING_FORMAT_SNORM16X4: { uvec2 v = RawDataUint2(ptr).data[0u]; return vec4(unpackSnorm2x16(v.x), unpackSnorm2x16(v.y)); };
+        case BINDING_FORMAT_UNORM8X4: return unpackUnorm4x8(RawDataUintAligned(ptr).data[0u]);
+        case BINDING_FORMAT_OCTAHEDRAL: return vec4(decodeOctahedral(unpackSnorm2x16(RawDataUintAligned(ptr).data[0u])), 0.f);
+        case BINDING_FORMAT_UNORM10X3A2: return unpackUnorm10x3A2(RawDataUintAligned(ptr).data[0u]);
+    };
+    return uintBitsToFloat(RawDataUint4(ptr).data[0u]);
+};
+
+// read binding as float4, decoded by format
 vec4 readBinding4(in BindingInfo bindingInfo, in uint index) 
 {
     uint offset = bindingInfo.stride * index;
+    if ((bindingInfo.format & BINDING_ALIGNED) != 0u) { return readBinding4Aligned(bindingInfo, offset); };
+    switch (bindingInfo.format & BINDING_FORMAT_MASK) {
+        case BINDING_FORMAT_HALF4: return vec4(unpackHalf2x16(readUint32(bindingInfo.ptr, offset)), unpackHalf2x16(readUint32(bindingInfo.ptr, offset+4u)));
+        case BINDING_FORMAT_SNORM16X4: return vec4(unpackSnorm2x16(readUint32(bindingInfo.ptr, offset)), unpackSnorm2x16(readUint32(bindingInfo.ptr, offset+4u)));
+        case BINDING_FORMAT_UNORM8X4: return unpackUnorm4x8(readUint32(bindingInfo.ptr, offset));
+        case BINDING_FORMAT_OCTAHEDRAL: return vec4(decodeOctahedral(unpackSnorm2x16(readUint32(bindingInfo.ptr, offset))), 0.f);
+        case BINDING_FORMAT_UNORM10X3A2: return unpackUnorm10x3A2(readUint32(bindingInfo.ptr, offset));
+    };
     return readFloat4(bindingInfo.ptr, offset);
 };
 
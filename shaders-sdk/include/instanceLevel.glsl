@@ -12,6 +12,11 @@
 #define INSTANCE_LEVEL_MAP 2
 #endif
 
+// own (zero) and attached top levels
+#ifndef INSTANCE_LAYER_COUNT
+#define INSTANCE_LAYER_COUNT 4
+#endif
+
 // 
 struct InstanceInfo 
 {
@@ -31,6 +36,8 @@ struct InstanceInfo
 
 //
 layout (binding = 0, set = INSTANCE_LEVEL_MAP, scalar) buffer InstanceBuffer { InstanceInfo instances[]; };
+layout (binding = 3, set = INSTANCE_LEVEL_MAP, scalar) buffer LayerInstanceBuffer { InstanceInfo instances[]; } layers[INSTANCE_LAYER_COUNT];
+layout (binding = 4, set = INSTANCE_LEVEL_MAP, scalar) buffer LayerInfoBuffer { uvec4 layerInfo; }; // count and mask of attached layers
 
 // 
 GeometryInfo readGeometryInfo(inout InstanceInfo instance, in uint geometryId) 
@@ -44,6 +51,19 @@ GeometryInfo readGeometryInfo(in uint instanceId, in uint geometryId)
     return readGeometryInfo(instances[instanceId], geometryId);
 };
 
+// 
+InstanceInfo readInstance(in uint layerId, in uint instanceId) 
+{
+    return layers[layerId].instances[instanceId];
+};
+
+// 
+GeometryInfo readGeometryInfo(in uint layerId, in uint instanceId, in uint geometryId) 
+{
+    InstanceInfo instanceInfo = readInstance(layerId, instanceId);
+    return readGeometryInfo(instanceInfo, geometryId);
+};
+
 //
 AttributeInterpolated transformNormal(inout AttributeInterpolated attributes, in uint instanceId, in uint geometryId)
 {
@@ -53,6 +73,15 @@ AttributeInterpolated transformNormal(inout AttributeInterpolated attributes, in
     return attributes;
 };
 
+// of hit in attached layer
+AttributeInterpolated transformNormal(inout AttributeInterpolated attributes, in uint layerId, in uint instanceId, in uint geometryId)
+{
+    InstanceInfo instanceInfo = readInstance(layerId, instanceId);
+    GeometryInfo geometryInfo = readGeometryInfo(instanceInfo, geometryId);
+    attributes.normals = vec4(vec4(vec4(attributes.normals.xyz, 0.f) * geometryInfo.transform, 0.f) * instanceInfo.transform, 0.f);
+    return attributes;
+};
+
 //
 AttributeMap transformNormals(inout AttributeMap map, in uint instanceId, in uint geometryId)
 {
@@ -65,6 +94,17 @@ AttributeMap transformNormals(inout AttributeMap map, in uint instanceId, in uin
     return map;
 };
 
+// of hit in attached layer
+AttributeMap transformNormals(inout AttributeMap map, in uint layerId, in uint instanceId, in uint geometryId)
+{
+    InstanceInfo instanceInfo = readInstance(layerId, instanceId);
+    GeometryInfo geometryInfo = readGeometryInfo(instanceInfo, geometryId);
+    for (int i=0;i<3;i++) {
+        map.normals[i] = vec4(vec4(vec4(map.normals[i].xyz, 0.f) * inverse(geometryInfo.transform), 0.f) * inverse(instanceInfo.transform), 0.f);
+    };
+    return map;
+};
+
 //
 mat3x4 transformVertices(inout mat3x4 vertices, in uint instanceId, in uint geometryId) 
 {
@@ -76,5 +116,16 @@ mat3x4 transformVertices(inout mat3x4 vertices, in uint instanceId, in uint geom
     return vertices;
 };
 
+// of hit in attached layer
+mat3x4 transformVertices(inout mat3x4 vertices, in uint layerId, in uint instanceId, in uint geometryId) 
+{
+    InstanceInfo instanceInfo = readInstance(layerId, instanceId);
+    GeometryInfo geometryInfo = readGeometryInfo(instanceInfo, geometryId);
+    for (int i=0;i<3;i++) {
+        vertices[i] = vec4(vec4(vec4(vertices[i].xyz, 1.f) * geometryInfo.transform, 1.f) * instanceInfo.transform, 1.f);
+    };
+    return vertices;
+};
+
 
 #endif
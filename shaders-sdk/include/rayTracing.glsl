@@ -8,37 +8,12 @@
 #include "./instanceLevel.glsl"
 #include "./material.glsl"
 
-layout (binding = 1, set = INSTANCE_LEVEL_MAP) uniform accelerationStructureEXT acceleration;
+// unused layers are same as own
+layout (binding = 1, set = INSTANCE_LEVEL_MAP) uniform accelerationStructureEXT accelerations[INSTANCE_LAYER_COUNT];
+#define acceleration accelerations[0]
 
+// nearest of every layer (every next layer limited by previous hit)
 IntersectionInfo traceRays(in RayData rays, in float maxT) {
-    rayQueryEXT rayQuery;
-    rayQueryInitializeEXT(rayQuery, acceleration, gl_RayFlagsNoneEXT, 0xff, rays.origin.xyz, 0.001f, rays.direction.xyz, maxT);
-
-    while(rayQueryProceedEXT(rayQuery)) {
-        bool isOpaque = true;
-
-        {   // compute intersection opacity
-            uint instanceId = rayQueryGetIntersectionInstanceIdEXT(rayQuery, false);
-            uint geometryId = rayQueryGetIntersectionGeometryIndexEXT(rayQuery, false);
-            uint primitiveId = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, false);
-            GeometryInfo geometryInfo = readGeometryInfo(instanceId, geometryId);
-            uvec3 indices = readIndices(geometryInfo.index, primitiveId);
-            AttributeMap attributeMap = readAttributes3x4(geometryInfo.attributes, indices);
-            vec2 attribs = rayQueryGetIntersectionBarycentricsEXT(rayQuery, false);
-            AttributeInterpolated attributes = interpolateAttributes(attributeMap, vec3(1.f - attribs.x - attribs.y, attribs));
-            MaterialInfo material = handleMaterial(geometryInfo.primitive.materials, attributes);
-
-            if (material.baseColorFactor.a < 0.0001f) {
-                isOpaque = false;
-            };
-
-        };
-
-        if (isOpaque) {
-            rayQueryConfirmIntersectionEXT(rayQuery);
-        };
-    };
-
     IntersectionInfo result;
 
     {
@@ -47,15 +22,49 @@ IntersectionInfo traceRays(in RayData rays, in float maxT) {
         result.instanceId = 0u;
         result.geometryId = 0u;
         result.primitiveId = 0u;
+        result.layerId = 0u;
     };
 
-    if (rayQueryGetIntersectionTypeEXT(rayQuery, true) != gl_RayQueryCommittedIntersectionNoneEXT) {
-        vec2 attribs = rayQueryGetIntersectionBarycentricsEXT(rayQuery, true);
-        result.barycentric = vec3(1.f - attribs.x - attribs.y, attribs);
-        result.hitT = rayQueryGetIntersectionTEXT(rayQuery, true);
-        result.instanceId = rayQueryGetIntersectionInstanceIdEXT(rayQuery, true);
-        result.geometryId = rayQueryGetIntersectionGeometryIndexEXT(rayQuery, true);
-        result.primitiveId = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true);
+    const uint layerMask = layerInfo.y | 1u; // own is always traced, empty slots are skipped
+    for (uint layerId = 0u; layerId < INSTANCE_LAYER_COUNT; layerId++) {
+        if ((layerMask & (1u << layerId)) == 0u) { continue; };
+        rayQueryEXT rayQuery;
+        rayQueryInitializeEXT(rayQuery, accelerations[layerId], gl_RayFlagsNoneEXT, 0xff, rays.origin.xyz, 0.001f, rays.direction.xyz, result.hitT);
+
+        while(rayQueryProceedEXT(rayQuery)) {
+            bool isOpaque = true;
+
+            {   // compute intersection opacity
+                uint instanceId = rayQueryGetIntersectionInstanceIdEXT(rayQuery, false);
+                uint geometryId = rayQueryGetIntersectionGeometryIndexEXT(rayQuery, false);
+                uint primitiveId = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, false);
+                GeometryInfo geometryInfo = readGeometryInfo(layerId, instanceId, geometryId);
+                uvec3 indices = readIndices(geometryInfo.index, primitiveId);
+                AttributeMap attributeMap = readAttributes3x4(geometryInfo.attributes, indices);
+                vec2 attribs = rayQueryGetIntersectionBarycentricsEXT(rayQuery, false);
+                AttributeInterpolated attributes = interpolateAttributes(attributeMap, vec3(1.f - attribs.x - attribs.y, attribs));
+                MaterialInfo material = handleMaterial(geometryInfo.primitive.materials, attributes);
+
+                if (material.baseColorFactor.a < 0.0001f) {
+                    isOpaque = false;
+                };
+
+            };
+
+            if (isOpaque) {
+                rayQueryConfirmIntersectionEXT(rayQuery);
+            };
+        };
+
+        if (rayQueryGetIntersectionTypeEXT(rayQuery, true) != gl_RayQueryCommittedIntersectionNoneEXT) {
+            vec2 attribs = rayQueryGetIntersectionBarycentricsEXT(rayQuery, true);
+            result.barycentric = vec3(1.f - attribs.x - attribs.y, attribs);
+            result.hitT = rayQueryGetIntersectionTEXT(rayQuery, true);
+            result.instanceId = rayQueryGetIntersectionInstanceIdEXT(rayQuery, true);
+            result.geometryId = rayQueryGetIntersectionGeometryIndexEXT(rayQuery, true);
+            result.primitiveId = rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true);
+            result.layerId = layerId;
+        };
     };
 
     return result;
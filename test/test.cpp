@@ -3,6 +3,7 @@
 //
 #include <vkf/swapchain.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <filesystem>
 
 //
 #include <incavery/core.hpp>
@@ -33,6 +34,96 @@ struct Constants
     glm::mat3x4 lookAtInverse = glm::mat3x4(1.f);
 };
 
+// expected results of CPU side bookkeeping (upload ranges, registry slots and streams, transforms)
+bool checkCpuSide(vkh::uni_ptr<vkf::Device> device, vkh::uni_ptr<vkf::Queue> queue)
+{
+    bool passed = true;
+    auto check = [&passed](bool condition, const char* what) {
+        if (!condition) { std::cerr << "CPU check failed: " << what << std::endl; passed = false; };
+    };
+
+    // encoding, same as readBinding4
+    {
+        auto half = icv::GeometryRegistry::encodeBinding({ glm::vec4(1.f, 0.5f, -2.f, 0.f) }, icv::BindingFormat::Half4);
+        glm::u16vec4 packed = {}; if (half.size() == 8u) { memcpy(&packed, half.data(), 8u); };
+        check(half.size() == 8u && glm::unpackHalf(packed) == glm::vec4(1.f, 0.5f, -2.f, 0.f), "encodeBinding Half4");
+
+        auto unorm = icv::GeometryRegistry::encodeBinding({ glm::vec4(1.f, 0.f, 1.f, 0.f) }, icv::BindingFormat::Unorm8x4);
+        uint32_t word = 0u; if (unorm.size() == 4u) { memcpy(&word, unorm.data(), 4u); };
+        check(unorm.size() == 4u && word == 0x00FF00FFu, "encodeBinding Unorm8x4");
+    };
+
+    // dirty ranges merged, and clamped by copied data
+    {
+        icv::DataSet<uint32_t> dataSet(device, icv::DataSetInfo{ .count = 16u, .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT });
+        dataSet.copyFromCpu(queue);
+        dataSet.markDirty(4u, 2u);
+        dataSet.markDirty(0u, 2u);
+        dataSet.markDirty(2u, 2u);
+        dataSet.markDirty(10u, 1u);
+        auto ranges = dataSet.getDirtyRanges();
+        check(ranges.size() == 2u && ranges[0].offset == 0u && ranges[0].count == 6u && ranges[1].offset == 10u && ranges[1].count == 1u, "dirty ranges merge");
+        dataSet.copyFromVector(std::vector<uint32_t>(8u, 0u));
+        ranges = dataSet.getDirtyRanges();
+        check(ranges.size() == 1u && ranges[0].offset == 0u && ranges[0].count == 6u, "dirty ranges clamp");
+        dataSet.copyFromCpu(queue);
+    };
+
+    // free streams merged with neighbours, and relocated addresses
+    {
+        vkh::uni_ptr<icv::TransferBatch> batch = std::make_shared<icv::TransferBatch>(device, icv::TransferBatchInfo{ .arenaSize = 4096u });
+        icv::GeometryRegistry registry(device, icv::GeometryRegistryInfo{ .maxBindingCount = 4u, .arenaSize = 1024u });
+        std::vector<uint8_t> data(16u, 0u);
+        const VkDeviceAddress a = registry.pushIndexStream(data.data(), data.size(), batch);
+        const VkDeviceAddress b = registry.pushIndexStream(data.data(), data.size(), batch);
+        const VkDeviceAddress c = registry.pushIndexStream(data.data(), data.size(), batch);
+        registry.freeStream(a);
+        registry.freeStream(c);
+        check(registry.getFragmentation() > 0.f, "freeStream keeps hole");
+        registry.freeStream(b);
+        check(registry.getFragmentation() == 0.f, "freeStream merge");
+
+        //
+        const uintptr_t index = registry.pushStream(data.data(), data.size(), icv::BindingInfo{ .format = 0u, .stride = 16u }, batch);
+        const VkDeviceAddress previous = registry.getInfo().bindings[index].ptr.data;
+        const uint64_t generation = registry.getRelocationGeneration();
+        registry.relocateStreams(batch, 2048u);
+        const VkDeviceAddress current = registry.getInfo().bindings[index].ptr.data;
+        check(current != previous && registry.remapAddress(previous, generation) == current, "remapAddress");
+        batch->flush(queue);
+    };
+
+    // last binding moved into removed slot
+    {
+        icv::GeometryRegistry registry(device, icv::GeometryRegistryInfo{ .maxBindingCount = 4u });
+        const uintptr_t first = registry.pushBinding(icv::BindingInfo{ .ptr = { .data = 16u } });
+        const uintptr_t second = registry.pushBinding(icv::BindingInfo{ .ptr = { .data = 32u } });
+        const uintptr_t third = registry.pushBinding(icv::BindingInfo{ .ptr = { .data = 48u } });
+        registry.removeBinding(first);
+        const uint64_t generation = registry.getCompactionGeneration();
+        registry.compactBindings();
+        check(registry.remapBinding(intptr_t(third), generation) == intptr_t(first) && registry.remapBinding(intptr_t(second), generation) == intptr_t(second), "remapBinding");
+        check(registry.getInfo().bindings.size() == 2u && registry.getInfo().bindings[first].ptr.data == 48u, "compactBindings");
+    };
+
+    // only changed subtrees recomputed
+    {
+        icv::SceneGraph graph(icv::SceneGraphInfo{});
+        glm::mat3x4 rootLocal = glm::mat3x4(1.f); rootLocal[0].w = 1.f;
+        glm::mat3x4 childLocal = glm::mat3x4(1.f); childLocal[1].w = 2.f;
+        const uint32_t root = graph.createNode(icv::invalidSceneNode, rootLocal);
+        const uint32_t child = graph.createNode(root, childLocal);
+        check(graph.update() == 2u, "SceneGraph::update of new nodes");
+        check(graph.getWorld(child)[0].w == 1.f && graph.getWorld(child)[1].w == 2.f, "SceneGraph world transform");
+        graph.setLocal(child, childLocal);
+        check(graph.update() == 1u, "SceneGraph::update of leaf");
+        graph.setLocal(root, rootLocal);
+        check(graph.update() == 2u, "SceneGraph::update of subtree");
+    };
+
+    return passed;
+};
+
 // 
 int main() {
     glfwSetErrorCallback(error);
@@ -70,6 +161,11 @@ int main() {
     device->create(0u, surface.surface);
     queue->create();
 
+    //
+    if (!checkCpuSide(device, queue)) {
+        glfwTerminate(); return -1;
+    };
+
     // 
     vkf::SurfaceFormat& format = manager->getSurfaceFormat();
     VkRenderPass& renderPass = manager->createRenderPass();
@@ -267,30 +363,38 @@ int main() {
     vkt::AllocateDescriptorSetWithUpdate(device->dispatch, descriptorSetHelper, constantsSet, created);
 
 
-    // TODO: needs flush data
+    // staging slice per frame in flight
+    const uint32_t framesInFlight = uint32_t(framebuffers.size());
+
+    // uploaded by renderer with every frame
     vkh::uni_ptr<icv::MaterialSet<icv::MaterialSource>> materialSet = std::make_shared<icv::MaterialSet<icv::MaterialSource>>(device, icv::MaterialSetInfo<icv::MaterialSource>{
-        .maxMaterialCount = 8u
+        .maxMaterialCount = 8u,
+        .stagingCount = framesInFlight
     });
 
     //
     vkh::uni_ptr<icv::GeometryRegistry> geometryRegistry = std::make_shared<icv::GeometryRegistry>(device, icv::GeometryRegistryInfo{
-        .maxBindingCount = 8u
+        .maxBindingCount = 8u,
+        .stagingCount = framesInFlight
     });
 
     //
     vkh::uni_ptr<icv::GeometryLevel> geometryLevel = std::make_shared<icv::GeometryLevel>(device, icv::GeometryLevelInfo{
         .registry = geometryRegistry,
-        .maxGeometryCount = 2u
+        .maxGeometryCount = 2u,
+        .stagingCount = framesInFlight
     });
 
     // 
     vkh::uni_ptr<icv::InstanceLevel> instanceLevel = std::make_shared<icv::InstanceLevel>(device, icv::InstanceLevelInfo{
-        .maxInstanceCount = 1u
+        .maxInstanceCount = 1u,
+        .stagingCount = framesInFlight
     });
 
     // 
     vkh::uni_ptr<icv::DrawInstanceLevel> drawInstanceLevel = std::make_shared<icv::DrawInstanceLevel>(device, icv::DrawInstanceLevelInfo{
-        .maxInstanceCount = 1u
+        .maxInstanceCount = 1u,
+        .stagingCount = framesInFlight
     });
 
     // 
@@ -477,12 +581,24 @@ int main() {
         }
     });
 
+    // for instance levels with native instances on device (otherwise packed by CPU)
+    vkh::uni_ptr<icv::ComputePipeline> nativeInstancesPipeline = {};
+    if (std::filesystem::exists("./shaders/nativeInstances.comp.spv")) {
+        nativeInstancesPipeline = std::make_shared<icv::ComputePipeline>(device, icv::ComputePipelineInfo{
+            .layout = pipelineLayoutIcv,
+            .path = {
+                .compute = "./shaders/nativeInstances.comp.spv"
+            }
+        });
+    };
+
 
     // 
     renderer->setFramebuffer(framebuffer);
     renderer->pushGraphicsPipeline(graphicsPipeline);
     renderer->changeRayTracingComputePipeline(rayTracingPipeline);
     renderer->changeIndirectComputePipeline(instancedPipeline);
+    renderer->changeNativeInstanceComputePipeline(nativeInstancesPipeline);
 
     // setup instance data from geometry levels
     renderer->setGeometryReferences();
@@ -535,25 +651,26 @@ int main() {
     constantsBuffer[0].lookAt = glm::mat3x4(glm::transpose(lkat));
     constantsBuffer[0].lookAtInverse = glm::mat3x4(glm::transpose(glm::inverse(lkat)));
 
-    // 
-    int64_t currSemaphore = -1;
+    // frame number tags resources retired while recording, released when fence of that frame was waited
+    uint64_t frameCount = 0ull;
     uint32_t currentBuffer = 0u;
-    uint32_t frameCount = 0u;
+    std::vector<uint64_t> fenceFrames(framesInFlight, 0ull);
+    std::vector<vkh::uni_ptr<icv::TransferBatch>> batches = {};
+    for (uint32_t i = 0u; i < framesInFlight; i++) { batches.push_back(std::make_shared<icv::TransferBatch>(device)); };
 
     // 
     while (!glfwWindowShouldClose(surface.window)) { // 
         glfwPollEvents();
 
-        // 
-        int64_t n_semaphore = currSemaphore, c_semaphore = (currSemaphore + 1) % framebuffers.size(); // Next Semaphore
-        currSemaphore = (c_semaphore = c_semaphore >= 0 ? c_semaphore : int64_t(framebuffers.size()) + c_semaphore); // Current Semaphore
-        (n_semaphore = n_semaphore >= 0 ? n_semaphore : int64_t(framebuffers.size()) + n_semaphore); // Fix for Next Semaphores
+        // slot of frame in flight (fence, semaphores, command buffer, staging slice and upload batch)
+        const uint32_t slot = uint32_t(frameCount % framesInFlight);
+        const uint64_t frame = ++frameCount;
 
         // 
-        vkt::handleVk(device->dispatch->WaitForFences(1u, &framebuffers[c_semaphore].waitFence, true, 30ull * 1000ull * 1000ull * 1000ull));
-        vkt::handleVk(device->dispatch->ResetFences(1u, &framebuffers[c_semaphore].waitFence));
-        vkt::handleVk(device->dispatch->AcquireNextImageKHR(swapchain, std::numeric_limits<uint64_t>::max(), framebuffers[c_semaphore].presentSemaphore, nullptr, &currentBuffer));
-        //fw->getDeviceDispatch()->SignalSemaphore(vkh::VkSemaphoreSignalInfo{.semaphore = framebuffers[n_semaphore].semaphore, .value = 1u});
+        vkt::handleVk(device->dispatch->WaitForFences(1u, &framebuffers[slot].waitFence, true, 30ull * 1000ull * 1000ull * 1000ull));
+        vkt::handleVk(device->dispatch->ResetFences(1u, &framebuffers[slot].waitFence));
+        renderer->releaseRetired(fenceFrames[slot]);
+        vkt::handleVk(device->dispatch->AcquireNextImageKHR(swapchain, std::numeric_limits<uint64_t>::max(), framebuffers[slot].presentSemaphore, nullptr, &currentBuffer));
 
         // 
         vkh::VkClearValue clearValues[2] = { {}, {} };
@@ -561,111 +678,106 @@ int main() {
         clearValues[1].depthStencil = VkClearDepthStencilValue{ 1.0f, 0 };
 
         // Create render submission 
-        std::vector<VkSemaphore> waitSemaphores = { framebuffers[currentBuffer].presentSemaphore }, signalSemaphores = { framebuffers[currentBuffer].drawSemaphore };
+        std::vector<VkSemaphore> waitSemaphores = { framebuffers[slot].presentSemaphore }, signalSemaphores = { framebuffers[slot].drawSemaphore };
         std::vector<VkPipelineStageFlags> waitStages = {
             vkh::VkPipelineStageFlags{.eFragmentShader = 1, .eComputeShader = 1, .eTransfer = 1, .eRayTracingShader = 1, .eAccelerationStructureBuild = 1 },
             vkh::VkPipelineStageFlags{.eFragmentShader = 1, .eComputeShader = 1, .eTransfer = 1, .eRayTracingShader = 1, .eAccelerationStructureBuild = 1 }
         };
 
-        // create command buffer (with rewrite)
-        VkCommandBuffer& commandBuffer = framebuffers[currentBuffer].commandBuffer;
-        if (!commandBuffer) {
-            commandBuffer = vkt::createCommandBuffer(device->dispatch, queue->commandPool, false, false); // do reference of cmd buffer
-
-            {   // Use as present image
-                auto aspect = vkh::VkImageAspectFlags{ .eColor = 1u };
-                vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
-                    .image = framebuffers[currentBuffer].image,
-                    .targetLayout = VK_IMAGE_LAYOUT_GENERAL,
-                    .originLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                    .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
-                });
-            };
-
-            {   // Reuse depth as general
-                auto aspect = vkh::VkImageAspectFlags{ .eDepth = 1u, .eStencil = 1u };
-                vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
-                    .image = manager->depthImage.getImage(),
-                    .targetLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-                    .originLayout = VK_IMAGE_LAYOUT_GENERAL,
-                    .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
-                });
-            };
-
-            // 
-            materialSet->copyCommand(commandBuffer);
-
-            //
-            geometryRegistry->copyCommand(commandBuffer);
-
-            //
-            geometryLevel->buildCommand(commandBuffer);
-
-            //
-            instanceLevel->buildCommand(commandBuffer);
-
-            // THIS LINE REQUIRED! OTHERWISE YOU GET BSOD!
-            drawInstanceLevel->buildCommand(commandBuffer); 
-
-            // 
-            renderer->createRenderingCommand(commandBuffer);
-            vkt::commandBarrier(device->dispatch, commandBuffer);
-
-            // rasterization
-            device->dispatch->CmdBeginRenderPass(commandBuffer, vkh::VkRenderPassBeginInfo{ .renderPass = renderPass, .framebuffer = framebuffers[currentBuffer].frameBuffer, .renderArea = renderArea, .clearValueCount = 2u, .pClearValues = reinterpret_cast<vkh::VkClearValue*>(&clearValues[0]) }, VK_SUBPASS_CONTENTS_INLINE);
-            device->dispatch->CmdSetViewport(commandBuffer, 0u, 1u, viewport);
-            device->dispatch->CmdSetScissor(commandBuffer, 0u, 1u, renderArea);
-            device->dispatch->CmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, finalPipeline);
-            device->dispatch->CmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0u, descriptorSets.size(), descriptorSets.data(), 0u, nullptr);
-            device->dispatch->CmdDraw(commandBuffer, 4, 1, 0, 0);
-            device->dispatch->CmdEndRenderPass(commandBuffer);
-            vkt::commandBarrier(device->dispatch, commandBuffer);
-
-            // Use as present image
-            {
-                auto aspect = vkh::VkImageAspectFlags{ .eColor = 1u };
-                vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
-                    .image = framebuffers[currentBuffer].image,
-                    .targetLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                    .originLayout = VK_IMAGE_LAYOUT_GENERAL,
-                    .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
-                });
-            };
-
-            // Reuse depth as general
-            {
-                auto aspect = vkh::VkImageAspectFlags{ .eDepth = 1u, .eStencil = 1u };
-                vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
-                    .image = manager->depthImage.getImage(),
-                    .targetLayout = VK_IMAGE_LAYOUT_GENERAL,
-                    .originLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-                    .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
-                });
-            };
-
-            // 
-            device->dispatch->EndCommandBuffer(commandBuffer);
+        // uploads of changed data only, into staging slice of frame
+        renderer->setRecordingFrame(frame);
+        renderer->selectStaging(slot);
+        renderer->enqueueUploads(batches[slot]);
+
+        // recorded with every frame (previous one of slot is completed)
+        VkCommandBuffer& commandBuffer = framebuffers[slot].commandBuffer;
+        if (commandBuffer) { device->dispatch->FreeCommandBuffers(queue->commandPool, 1u, &commandBuffer); };
+        commandBuffer = vkt::createCommandBuffer(device->dispatch, queue->commandPool, false, false); // do reference of cmd buffer
+
+        {   // Use as present image
+            auto aspect = vkh::VkImageAspectFlags{ .eColor = 1u };
+            vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
+                .image = framebuffers[currentBuffer].image,
+                .targetLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .originLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
+            });
+        };
+
+        {   // Reuse depth as general
+            auto aspect = vkh::VkImageAspectFlags{ .eDepth = 1u, .eStencil = 1u };
+            vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
+                .image = manager->depthImage.getImage(),
+                .targetLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .originLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
+            });
         };
 
-        // Submit command once
+        // copies of batch, then dirty levels built (bottom before top)
+        batches[slot]->cmdFlush(commandBuffer);
+        renderer->buildGeometryLevels(commandBuffer);
+        renderer->buildInstanceLevel(commandBuffer);
+
+        // 
+        renderer->createRenderingCommand(commandBuffer);
+        vkt::commandBarrier(device->dispatch, commandBuffer);
+
+        // rasterization
+        device->dispatch->CmdBeginRenderPass(commandBuffer, vkh::VkRenderPassBeginInfo{ .renderPass = renderPass, .framebuffer = framebuffers[currentBuffer].frameBuffer, .renderArea = renderArea, .clearValueCount = 2u, .pClearValues = reinterpret_cast<vkh::VkClearValue*>(&clearValues[0]) }, VK_SUBPASS_CONTENTS_INLINE);
+        device->dispatch->CmdSetViewport(commandBuffer, 0u, 1u, viewport);
+        device->dispatch->CmdSetScissor(commandBuffer, 0u, 1u, renderArea);
+        device->dispatch->CmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, finalPipeline);
+        device->dispatch->CmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0u, descriptorSets.size(), descriptorSets.data(), 0u, nullptr);
+        device->dispatch->CmdDraw(commandBuffer, 4, 1, 0, 0);
+        device->dispatch->CmdEndRenderPass(commandBuffer);
+        vkt::commandBarrier(device->dispatch, commandBuffer);
+
+        // Use as present image
+        {
+            auto aspect = vkh::VkImageAspectFlags{ .eColor = 1u };
+            vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
+                .image = framebuffers[currentBuffer].image,
+                .targetLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                .originLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
+            });
+        };
+
+        // Reuse depth as general
+        {
+            auto aspect = vkh::VkImageAspectFlags{ .eDepth = 1u, .eStencil = 1u };
+            vkt::imageBarrier(commandBuffer, vkt::ImageBarrierInfo{
+                .image = manager->depthImage.getImage(),
+                .targetLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .originLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                .subresourceRange = vkh::VkImageSubresourceRange{ aspect, 0u, 1u, 0u, 1u }
+            });
+        };
+
+        // 
+        device->dispatch->EndCommandBuffer(commandBuffer);
+
+        // Submit command of frame
         vkt::handleVk(device->dispatch->QueueSubmit(queue->queue, 1u, vkh::VkSubmitInfo{
             .waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size()), .pWaitSemaphores = waitSemaphores.data(), .pWaitDstStageMask = waitStages.data(),
             .commandBufferCount = 1u, .pCommandBuffers = &commandBuffer,
             .signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size()), .pSignalSemaphores = signalSemaphores.data()
-        }, framebuffers[currentBuffer].waitFence));
+        }, framebuffers[slot].waitFence));
+        fenceFrames[slot] = frame;
 
         // 
-        waitSemaphores = { framebuffers[c_semaphore].drawSemaphore };
+        waitSemaphores = { framebuffers[slot].drawSemaphore };
         vkt::handleVk(device->dispatch->QueuePresentKHR(queue->queue, vkh::VkPresentInfoKHR{
             .waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size()), .pWaitSemaphores = waitSemaphores.data(),
             .swapchainCount = 1, .pSwapchains = &swapchain,
             .pImageIndices = &currentBuffer, .pResults = nullptr
         }));
-
-
-
     };
 
+    // resources of every frame
+    vkt::handleVk(device->dispatch->DeviceWaitIdle());
+    renderer->releaseRetired(frameCount);
 
     return 0;
 };